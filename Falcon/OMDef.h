@@ -1,30 +1,30 @@
 #pragma once
 
-const OMPropDef   LightProps[] =
+constexpr OMPropDef   LightProps[] =
 {
     { 'a', "Anim",    OMT_LONG, OMF_NONE,    0, 100 },   // UNDONE: backfill this?
     { 'o', "On",      OMT_BOOL, OMF_NONE, },
     { 'c', "Color1",  OMT_LONG, OMF_NONE,    0, 0xFFFFFF, 16 },
     { 'd', "Color2",  OMT_LONG, OMF_NONE,    0, 0xFFFFFF, 16 },
-    { 's', "Speed",   OMT_LONG, OMF_NONE,    0, 60000 },
+    { 's', "Speed",   OMT_LONG, OMF_NONE,    0, 60000, 0, nullptr, 10, 50 },  // 10 ms steps
     { 'r', "Reverse", OMT_BOOL, OMF_NONE, },
     { }
 };
 
-const OMPropDef   GroupProps[] =
+constexpr OMPropDef   GroupProps[] =
 {
     { 'o', "On",      OMT_BOOL, OMF_NONE },
     { }
 };
 
-const OMObjDef    TubesObjs[] =
+constexpr OMObjDef    TubesObjs[] =
 {
     { 's', "Sconce",    nullptr,    LightProps, &LightConn },
     { 'f', "Floor",     nullptr,    LightProps, &LightConn },
     { }
 };
 
-const OMObjDef    HoldObjs[] =
+constexpr OMObjDef    HoldObjs[] =
 {
     { 'y', "Bay",       nullptr,    LightProps, &LightConn },
     { 'b', "Bed",       nullptr,    LightProps, &LightConn },
@@ -37,7 +37,7 @@ const OMObjDef    HoldObjs[] =
     { }
 };
 
-const OMObjDef    CockpitObjs[] =
+constexpr OMObjDef    CockpitObjs[] =
 {
     { 'm', "Monitor",   nullptr,    LightProps, &LightConn },
     { '0', "Red",       nullptr,    LightProps, &LightConn },
@@ -51,7 +51,7 @@ const OMObjDef    CockpitObjs[] =
     { }
 };
 
-const OMObjDef    LightObjs[] =
+constexpr OMObjDef    LightObjs[] =
 {
     { 'e', "Engine",    nullptr,    LightProps, &LightConn },
     { 'l', "Landing",   nullptr,    LightProps, &LightConn },
@@ -66,37 +66,53 @@ const OMObjDef    LightObjs[] =
     { }
 };
 
-const OMPropDef   RectProps[] =
+constexpr OMPropDef   RectProps[] =
 {
     { 's', "Sweep",    OMT_BOOL, OMF_NONE },
     { 'v', "Speed",    OMT_LONG, OMF_NONE, 0, 100 },
-    { 'p', "Position", OMT_LONG, OMF_NONE, 0, 100 },
+    { 'p', "Position", OMT_LONG, OMF_NONE, 0, 100, 0, nullptr, 1, 2 },
     { }
 };
 
-const OMPropDef   RampProps[] =
+constexpr OMPropDef   RampProps[] =
 {
     { 's', "State",    OMT_CHAR, OMF_NONE, 0, 0, 0, "RrSeE" },
     { 'v', "Speed",    OMT_LONG, OMF_NONE, 0, 100 },
     { }
 };
 
-const OMPropDef   SoundProps[] =
+constexpr OMPropDef   SoundProps[] =
 {
     { 'p', "Play",    OMT_LONG,   OMF_WO_DEVICE, 1, 100 },
-    { 'v', "Volume",  OMT_LONG,   OMF_NONE,      0,  21 },
+    { 'v', "Volume",  OMT_LONG,   OMF_PERSIST,   0,  21 },
     { 'x', "Delete",  OMT_LONG,   OMF_WO_DEVICE, 1, 100 },
     { 'l', "List",    OMT_STRING, OMF_RO_DEVICE },     // list must be last to set Max for Play and Delete
     { }
 };
 
-const OMPropDef   DebugProps[] =
+constexpr OMPropDef   DebugProps[] =
 {
-    { 'l', "LogLevel", OMT_CHAR, OMF_LOCAL, 0, 0, 0, "NFEWIDV" },
+    { 'l', "LogLevel",   OMT_CHAR, OMF_LOCAL, 0, 0, 0, "NFEWIDV" },
+    { 'c', "InBudget",   OMT_LONG, OMF_LOCAL, 1, 1000 },        // input commands per Run
+    { 'u', "InBudgetUS", OMT_LONG, OMF_LOCAL, 0, 100000 },      // input processing time per Run
+    { 'q', "InDepth",    OMT_LONG, OMF_LOCAL, 0, LONG_MAX },    // input commands queued
+    { 'a', "InLatAvg",   OMT_LONG, OMF_LOCAL, 0, LONG_MAX },    // enqueue to apply microseconds
+    { 'm', "InLatMax",   OMT_LONG, OMF_LOCAL, 0, LONG_MAX },
+    { 't', "RttUS",      OMT_LONG, OMF_LOCAL, 0, LONG_MAX },    // frame to ACK round trip
+    { 'o', "LossPM",     OMT_LONG, OMF_LOCAL, 0, 1000 },        // failed sends per thousand
+    { 'r', "RSSI",       OMT_LONG, OMF_LOCAL, -128, 0 },        // dBm of the peer's last frame, with ESPNAgent::TrackRssi
+    { 'h', "HeartMS",    OMT_LONG, OMF_LOCAL, 0, LONG_MAX },    // heartbeat period
+    { 'k', "CmdRate",    OMT_LONG, OMF_LOCAL, 0, LONG_MAX },    // input commands applied per second
+    { 'b', "FrameBytes", OMT_LONG, OMF_LOCAL, 0, 250 },         // average output frame size
+    { 'p', "ApplyP50",   OMT_LONG, OMF_LOCAL, 0, LONG_MAX },    // microseconds to apply a command
+    { 'y', "ApplyP99",   OMT_LONG, OMF_LOCAL, 0, LONG_MAX },
+    { 'w', "PrefWrites", OMT_LONG, OMF_LOCAL, 0, LONG_MAX },    // preference blobs written to flash
+    { 'z', "PrefSkips",  OMT_LONG, OMF_LOCAL, 0, LONG_MAX },    // writes skipped as unchanged
+    { 'v', "AutoSaves",  OMT_LONG, OMF_LOCAL, 0, LONG_MAX },
     { }
 };
 
-const OMObjDef    Objects[] =
+constexpr OMObjDef    Objects[] =
 {
     { 'l', "Lights",    LightObjs, nullptr },
     { 'a', "Rectenna",  nullptr,   RectProps,  &RectennaConn },
@@ -106,7 +122,7 @@ const OMObjDef    Objects[] =
     { }
 };
 
-const OMPropDef   RootProps[] =
+constexpr OMPropDef   RootProps[] =
 {
     { 'x', "Restart",   OMT_LONG, OMF_WO_DEVICE, 1234, 1234  },
     { 'f', "FreeSpace", OMT_LONG, OMF_RO_DEVICE, 0, LONG_MAX },
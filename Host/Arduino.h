@@ -0,0 +1,142 @@
+#pragma once
+
+// host (Linux) stand-in for the parts of the Arduino ESP32 core the libraries use
+// see Host.h for the controls tests and simulations have over it
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cstdarg>
+#include <climits>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+
+typedef bool    boolean;
+typedef uint8_t byte;
+
+class String
+{
+public:
+    String() {}
+    String(const char* cstr) : S(cstr ? cstr : "") { Fit(); }
+    String(const char* cstr, unsigned int length) : S(cstr, length) { Fit(); }
+    String(const uint8_t* cstr, unsigned int length) : S((const char*)cstr, length) { Fit(); }
+    String(const String& str) : S(str.S) { Fit(); }
+    explicit String(char c) : S(1, c) {}
+    explicit String(unsigned char value, unsigned char base = 10) : String((unsigned long)value, base) {}
+    explicit String(int value, unsigned char base = 10) : String((long)value, base) {}
+    explicit String(unsigned int value, unsigned char base = 10) : String((unsigned long)value, base) {}
+    explicit String(long value, unsigned char base = 10);
+    explicit String(unsigned long value, unsigned char base = 10);
+    explicit String(double value, unsigned int decimalPlaces = 2);
+    String& operator=(const String& rhs) { S = rhs.S; Fit(); return *this; }
+    String& operator=(const char* cstr) { S = cstr ? cstr : ""; Fit(); return *this; }
+
+    unsigned int length() const { return S.size(); }
+    const char* c_str() const { return S.c_str(); }
+    bool        reserve(unsigned int size) { S.reserve(size); return true; }
+    void        clear() { S.clear(); }
+    bool        isEmpty() const { return S.empty(); }
+
+    bool        concat(const String& str) { S += str.S; Fit(); return true; }
+    bool        concat(const char* cstr) { if (cstr) S += cstr; Fit(); return true; }
+    bool        concat(char c) { S += c; Fit(); return true; }
+    bool        concat(int num) { return concat(String(num)); }
+    bool        concat(unsigned int num) { return concat(String(num)); }
+    bool        concat(long num) { return concat(String(num)); }
+    bool        concat(unsigned long num) { return concat(String(num)); }
+    String&     operator+=(const String& rhs) { concat(rhs); return *this; }
+    String&     operator+=(const char* cstr) { concat(cstr); return *this; }
+    String&     operator+=(char c) { concat(c); return *this; }
+    String&     operator+=(int num) { concat(num); return *this; }
+    String&     operator+=(unsigned int num) { concat(num); return *this; }
+    String&     operator+=(long num) { concat(num); return *this; }
+    String&     operator+=(unsigned long num) { concat(num); return *this; }
+
+    int         compareTo(const String& s) const { return S.compare(s.S); }
+    bool        equals(const String& s) const { return S == s.S; }
+    bool        equals(const char* cstr) const { return S == (cstr ? cstr : ""); }
+    bool        operator==(const String& rhs) const { return equals(rhs); }
+    bool        operator==(const char* cstr) const { return equals(cstr); }
+    bool        operator!=(const String& rhs) const { return !equals(rhs); }
+    bool        operator!=(const char* cstr) const { return !equals(cstr); }
+    bool        operator<(const String& rhs) const { return S < rhs.S; }
+    bool        startsWith(const String& prefix) const { return S.compare(0, prefix.S.size(), prefix.S) == 0; }
+    bool        endsWith(const String& suffix) const
+    {
+        return S.size() >= suffix.S.size() && S.compare(S.size() - suffix.S.size(), suffix.S.size(), suffix.S) == 0;
+    }
+
+    char        charAt(unsigned int index) const { return index < S.size() ? S[index] : 0; }
+    void        setCharAt(unsigned int index, char c) { if (index < S.size()) S[index] = c; }
+    char        operator[](unsigned int index) const { return charAt(index); }
+    char&       operator[](unsigned int index);
+
+    int         indexOf(char ch, unsigned int fromIndex = 0) const { return Found(S.find(ch, fromIndex)); }
+    int         indexOf(const String& str, unsigned int fromIndex = 0) const { return Found(S.find(str.S, fromIndex)); }
+    int         lastIndexOf(char ch) const { return Found(S.rfind(ch)); }
+    int         lastIndexOf(const String& str) const { return Found(S.rfind(str.S)); }
+    String      substring(unsigned int beginIndex) const { return beginIndex < S.size() ? String(S.substr(beginIndex)) : String(); }
+    String      substring(unsigned int beginIndex, unsigned int endIndex) const;
+
+    void        replace(char find, char replace) { std::replace(S.begin(), S.end(), find, replace); }
+    void        remove(unsigned int index) { if (index < S.size()) S.erase(index); }
+    void        remove(unsigned int index, unsigned int count) { if (index < S.size()) S.erase(index, count); }
+    void        toLowerCase();
+    void        toUpperCase();
+    void        trim();
+
+    long        toInt() const { return strtol(S.c_str(), nullptr, 10); }
+    float       toFloat() const { return strtof(S.c_str(), nullptr); }
+    double      toDouble() const { return strtod(S.c_str(), nullptr); }
+
+    // the core keeps up to SsoMax characters in the String itself (libstdc++ keeps 15);
+    // longer ones go to the heap here too, so allocation counts follow the core's
+    // (past that, growth is libstdc++'s: the core reallocates to the exact length more often)
+    static const unsigned int SsoMax = 14;
+
+private:
+    std::string S;
+    explicit String(std::string&& s) : S(std::move(s)) { Fit(); }
+    void        Fit() { if (S.size() > SsoMax && S.capacity() <= SsoMax + 1) S.reserve(SsoMax + 2); }
+    static int  Found(size_t pos) { return pos == std::string::npos ? -1 : (int)pos; }
+    friend String operator+(const String& lhs, const String& rhs);
+};
+
+String operator+(const String& lhs, const String& rhs);
+inline String operator+(const String& lhs, const char* rhs) { return lhs + String(rhs); }
+inline String operator+(const char* lhs, const String& rhs) { return String(lhs) + rhs; }
+inline String operator+(const String& lhs, char rhs) { return lhs + String(rhs); }
+inline String operator+(char lhs, const String& rhs) { return String(lhs) + rhs; }
+
+class HostSerial
+{
+public:
+    int         available();
+    int         read();
+    size_t      write(uint8_t c);
+    size_t      write(const uint8_t* buffer, size_t size);
+    size_t      print(const char* s);
+    size_t      print(const String& s) { return print(s.c_str()); }
+    size_t      println(const char* s = "");
+    size_t      println(const String& s) { return println(s.c_str()); }
+    size_t      printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+    void        begin(unsigned long) {}
+    void        flush() { fflush(stdout); }
+};
+extern HostSerial Serial;
+
+unsigned long   millis();
+unsigned long   micros();
+void            delay(unsigned long ms);
+void            delayMicroseconds(unsigned int us);
+void            yield();
+void            noInterrupts();
+void            interrupts();
+uint32_t        esp_random();
+const char*     pathToFileName(const char* path);
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <Arduino.h>
+#include <memory>
+
+// host file system: an FS maps the flash paths it is given onto a directory
+#define FILE_READ       "r"
+#define FILE_WRITE      "w"
+#define FILE_APPEND     "a"
+
+namespace fs
+{
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+class File
+{
+public:
+    size_t      write(uint8_t c) { return write(&c, 1); }
+    size_t      write(const uint8_t* buf, size_t size);
+    int         read();
+    size_t      read(uint8_t* buf, size_t size);
+    size_t      readBytes(char* buf, size_t length) { return read((uint8_t*)buf, length); }
+    int         available() { return (int)(size() - position()); }
+    bool        seek(uint32_t pos, SeekMode mode = SeekSet);
+    size_t      position() const;
+    size_t      size() const;
+    void        flush();
+    void        close() { Fp.reset(); }
+    operator    bool() const { return (bool)Fp; }
+private:
+    friend class FS;
+    std::shared_ptr<FILE> Fp;
+};
+
+class FS
+{
+public:
+    explicit FS(const char* root = ".") : Root(root) {}
+    File        open(const char* path, const char* mode = FILE_READ, bool create = false);
+    File        open(const String& path, const char* mode = FILE_READ, bool create = false) { return open(path.c_str(), mode, create); }
+    bool        exists(const char* path);
+    bool        remove(const char* path);
+    bool        rename(const char* pathFrom, const char* pathTo);
+    bool        mkdir(const char* path);
+private:
+    std::string Root;
+    std::string Full(const char* path) const { return Root + (path[0] == '/' ? "" : "/") + path; }
+};
+}
+
+using fs::FS;
+using fs::File;
+using fs::SeekMode;
+using fs::SeekSet;
+using fs::SeekCur;
+using fs::SeekEnd;
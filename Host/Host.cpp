@@ -0,0 +1,597 @@
+#include "Host.h"
+#include "FS.h"
+#include "Preferences.h"
+#include "WiFi.h"
+#include "WiFiUdp.h"
+#include "esp_now.h"
+#include "esp_wifi.h"
+#include <cerrno>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// String
+
+String::String(long value, unsigned char base)
+{
+    // like the core's ltoa: signed in decimal, two's complement bits in other bases
+    if (base == 10)
+    {
+        S = std::to_string(value);
+        Fit();
+    }
+    else
+        *this = String((unsigned long)(uint32_t)value, base);
+}
+
+String::String(unsigned long value, unsigned char base)
+{
+    if (base < 2 || base > 36)
+        base = 10;
+    char buf[8 * sizeof(value) + 1];
+    char* p = buf + sizeof(buf) - 1;
+    *p = 0;
+    do
+    {
+        auto digit = value % base;
+        *--p = digit < 10 ? '0' + digit : 'a' + digit - 10;
+        value /= base;
+    } while (value);
+    S = p;
+    Fit();
+}
+
+String::String(double value, unsigned int decimalPlaces)
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.*f", decimalPlaces, value);
+    S = buf;
+    Fit();
+}
+
+char& String::operator[](unsigned int index)
+{
+    static char dummy;
+    if (index >= S.size())
+    {
+        dummy = 0;
+        return dummy;
+    }
+    return S[index];
+}
+
+String String::substring(unsigned int beginIndex, unsigned int endIndex) const
+{
+    if (beginIndex > endIndex)
+        std::swap(beginIndex, endIndex);
+    if (beginIndex >= S.size())
+        return String();
+    return String(S.substr(beginIndex, endIndex - beginIndex));
+}
+
+void String::toLowerCase()
+{
+    for (auto& c : S)
+        c = tolower(c);
+}
+
+void String::toUpperCase()
+{
+    for (auto& c : S)
+        c = toupper(c);
+}
+
+void String::trim()
+{
+    auto begin = S.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos)
+    {
+        S.clear();
+        return;
+    }
+    S = S.substr(begin, S.find_last_not_of(" \t\r\n") - begin + 1);
+}
+
+String operator+(const String& lhs, const String& rhs)
+{
+    return String(lhs.S + rhs.S);
+}
+
+// clock and core functions
+
+namespace
+{
+    std::chrono::steady_clock::time_point StartTime = std::chrono::steady_clock::now();
+    bool        Simulated = false;
+    std::atomic<uint64_t> SimulatedUS { 0 };
+    std::mt19937 Random { std::random_device()() };
+    std::mutex  RandomLock;
+}
+
+void Host::SimulateClock(uint64_t startUS)
+{
+    Simulated = true;
+    SimulatedUS = startUS;
+}
+
+void Host::AdvanceUS(uint32_t us)
+{
+    SimulatedUS += us;
+}
+
+void Host::Seed(uint32_t seed)
+{
+    std::lock_guard<std::mutex> lock(RandomLock);
+    Random.seed(seed);
+}
+
+static uint64_t NowUS()
+{
+    if (Simulated)
+        return SimulatedUS;
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - StartTime).count();
+}
+
+unsigned long millis() { return (uint32_t)(NowUS() / 1000); }
+unsigned long micros() { return (uint32_t)NowUS(); }
+
+void delay(unsigned long ms)
+{
+    if (Simulated)
+        SimulatedUS += ms * 1000;
+    else
+        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    if (Simulated)
+        SimulatedUS += us;
+    else
+        std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void yield() { std::this_thread::yield(); }
+void noInterrupts() {}
+void interrupts() {}
+
+uint32_t esp_random()
+{
+    std::lock_guard<std::mutex> lock(RandomLock);
+    return Random();
+}
+
+const char* pathToFileName(const char* path)
+{
+    auto name = strrchr(path, '/');
+    return name ? name + 1 : path;
+}
+
+// Serial
+
+HostSerial Serial;
+
+namespace
+{
+    std::deque<char> SerialRx;
+    bool        SerialQuiet = false;
+}
+
+void Host::SerialInput(const char* s)
+{
+    SerialRx.insert(SerialRx.end(), s, s + strlen(s));
+}
+
+void Host::QuietSerial(bool quiet) { SerialQuiet = quiet; }
+
+int HostSerial::available() { return SerialRx.size(); }
+
+int HostSerial::read()
+{
+    if (SerialRx.empty())
+        return -1;
+    char c = SerialRx.front();
+    SerialRx.pop_front();
+    return (uint8_t)c;
+}
+
+size_t HostSerial::write(uint8_t c) { return write(&c, 1); }
+
+size_t HostSerial::write(const uint8_t* buffer, size_t size)
+{
+    if (!SerialQuiet)
+        fwrite(buffer, 1, size, stdout);
+    return size;
+}
+
+size_t HostSerial::print(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+
+size_t HostSerial::println(const char* s) { return print(s) + print("\r\n"); }
+
+size_t HostSerial::printf(const char* format, ...)
+{
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (len < 0)
+        return 0;
+    return write((const uint8_t*)buf, (size_t)len < sizeof(buf) ? len : sizeof(buf) - 1);
+}
+
+// file system
+
+size_t fs::File::write(const uint8_t* buf, size_t size)
+{
+    return Fp ? fwrite(buf, 1, size, Fp.get()) : 0;
+}
+
+int fs::File::read()
+{
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+}
+
+size_t fs::File::read(uint8_t* buf, size_t size)
+{
+    return Fp ? fread(buf, 1, size, Fp.get()) : 0;
+}
+
+bool fs::File::seek(uint32_t pos, SeekMode mode)
+{
+    return Fp && fseek(Fp.get(), pos, mode == SeekSet ? SEEK_SET : mode == SeekCur ? SEEK_CUR : SEEK_END) == 0;
+}
+
+size_t fs::File::position() const
+{
+    return Fp ? ftell(Fp.get()) : 0;
+}
+
+size_t fs::File::size() const
+{
+    if (!Fp)
+        return 0;
+    fflush(Fp.get());
+    struct stat st;
+    return fstat(fileno(Fp.get()), &st) == 0 ? st.st_size : 0;
+}
+
+void fs::File::flush()
+{
+    if (Fp)
+        fflush(Fp.get());
+}
+
+fs::File fs::FS::open(const char* path, const char* mode, bool create)
+{
+    File file;
+    std::string m = mode;
+    // binary and, for a read, no creation
+    auto fp = fopen(Full(path).c_str(), (m == FILE_READ ? "rb" : m == FILE_APPEND ? "ab" : "wb"));
+    if (fp)
+        file.Fp.reset(fp, fclose);
+    return file;
+}
+
+bool fs::FS::exists(const char* path)
+{
+    struct stat st;
+    return stat(Full(path).c_str(), &st) == 0;
+}
+
+bool fs::FS::remove(const char* path) { return ::remove(Full(path).c_str()) == 0; }
+
+// like LittleFS, replaces an existing file
+bool fs::FS::rename(const char* pathFrom, const char* pathTo) { return ::rename(Full(pathFrom).c_str(), Full(pathTo).c_str()) == 0; }
+
+bool fs::FS::mkdir(const char* path) { return ::mkdir(Full(path).c_str(), 0755) == 0 || errno == EEXIST; }
+
+// preferences
+
+namespace
+{
+    std::map<std::string, std::map<std::string, std::vector<uint8_t>>> Nvs;
+    uint32_t    NvsWrites = 0;
+    const size_t NvsKeyMax = 15;
+}
+
+void Host::ClearPreferences()
+{
+    Nvs.clear();
+    NvsWrites = 0;
+}
+
+uint32_t Host::PreferenceWrites() { return NvsWrites; }
+
+bool Preferences::begin(const char* name, bool readOnly, const char*)
+{
+    if (!name || strlen(name) > NvsKeyMax)
+        return false;
+    Namespace = name;
+    ReadOnly = readOnly;
+    Started = true;
+    return true;
+}
+
+void Preferences::end() { Started = false; }
+
+bool Preferences::clear()
+{
+    if (!Started || ReadOnly)
+        return false;
+    Nvs[Namespace].clear();
+    ++NvsWrites;
+    return true;
+}
+
+bool Preferences::remove(const char* key)
+{
+    if (!Started || ReadOnly)
+        return false;
+    ++NvsWrites;
+    return Nvs[Namespace].erase(key) > 0;
+}
+
+bool Preferences::isKey(const char* key)
+{
+    return Started && Nvs[Namespace].count(key) > 0;
+}
+
+size_t Preferences::putBytes(const char* key, const void* value, size_t len)
+{
+    if (!Started || ReadOnly || !key || strlen(key) > NvsKeyMax || (!value && len))
+        return 0;
+    auto bytes = (const uint8_t*)value;
+    Nvs[Namespace][key].assign(bytes, bytes + len);
+    ++NvsWrites;
+    return len;
+}
+
+size_t Preferences::putString(const char* key, const char* value)
+{
+    // stored with its terminator, as NVS does
+    return putBytes(key, value, strlen(value) + 1) ? strlen(value) : 0;
+}
+
+size_t Preferences::getBytesLength(const char* key)
+{
+    if (!isKey(key))
+        return 0;
+    return Nvs[Namespace][key].size();
+}
+
+size_t Preferences::getBytes(const char* key, void* buf, size_t maxLen)
+{
+    auto len = getBytesLength(key);
+    if (len == 0 || len > maxLen)
+        return 0;
+    memcpy(buf, Nvs[Namespace][key].data(), len);
+    return len;
+}
+
+String Preferences::getString(const char* key, String defaultValue)
+{
+    if (!isKey(key))
+        return defaultValue;
+    auto& v = Nvs[Namespace][key];
+    return String((const char*)v.data(), strnlen((const char*)v.data(), v.size()));
+}
+
+uint32_t Preferences::getUInt(const char* key, uint32_t defaultValue)
+{
+    uint32_t value;
+    return getBytes(key, &value, sizeof(value)) == sizeof(value) ? value : defaultValue;
+}
+
+// Wi-Fi
+
+HostWiFi WiFi;
+
+namespace
+{
+    const uint8_t HostMac[ESP_NOW_ETH_ALEN] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+}
+
+const uint8_t* Host::MacAddress() { return HostMac; }
+
+String HostWiFi::macAddress()
+{
+    char buf[18];
+    snprintf(buf, sizeof(buf), "%02X:%02X:%02X:%02X:%02X:%02X", HostMac[0], HostMac[1], HostMac[2], HostMac[3], HostMac[4], HostMac[5]);
+    return String(buf);
+}
+
+String IPAddress::toString() const
+{
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u", Bytes[0], Bytes[1], Bytes[2], Bytes[3]);
+    return String(buf);
+}
+
+bool WiFiUDP::Open()
+{
+    if (Fd >= 0)
+        return true;
+    Fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (Fd < 0)
+        return false;
+    fcntl(Fd, F_SETFL, fcntl(Fd, F_GETFL) | O_NONBLOCK);
+    return true;
+}
+
+uint8_t WiFiUDP::begin(uint16_t port)
+{
+    stop();
+    if (!Open())
+        return 0;
+    int on = 1;
+    setsockopt(Fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(Fd, (sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+        stop();
+        return 0;
+    }
+    return 1;
+}
+
+void WiFiUDP::stop()
+{
+    if (Fd >= 0)
+        close(Fd);
+    Fd = -1;
+    RxLen = RxPos = 0;
+}
+
+int WiFiUDP::beginPacket(IPAddress ip, uint16_t port)
+{
+    if (!Open())
+        return 0;
+    DestIP = ip;
+    DestPort = port;
+    Tx.clear();
+    return 1;
+}
+
+size_t WiFiUDP::write(const uint8_t* buffer, size_t size)
+{
+    Tx.insert(Tx.end(), buffer, buffer + size);
+    return size;
+}
+
+int WiFiUDP::endPacket()
+{
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = (uint32_t)DestIP;
+    addr.sin_port = htons(DestPort);
+    auto sent = sendto(Fd, Tx.data(), Tx.size(), 0, (sockaddr*)&addr, sizeof(addr));
+    Tx.clear();
+    return sent >= 0 ? 1 : 0;
+}
+
+int WiFiUDP::parsePacket()
+{
+    RxLen = RxPos = 0;
+    if (Fd < 0)
+        return 0;
+    sockaddr_in addr = {};
+    socklen_t addrLen = sizeof(addr);
+    auto len = recvfrom(Fd, Rx, sizeof(Rx), 0, (sockaddr*)&addr, &addrLen);
+    if (len <= 0)
+        return 0;
+    RxLen = len;
+    RemoteIP = IPAddress(addr.sin_addr.s_addr);
+    RemotePort = ntohs(addr.sin_port);
+    return RxLen;
+}
+
+int WiFiUDP::read()
+{
+    return RxPos < RxLen ? Rx[RxPos++] : -1;
+}
+
+int WiFiUDP::read(uint8_t* buffer, size_t len)
+{
+    int n = std::min((int)len, RxLen - RxPos);
+    memcpy(buffer, Rx + RxPos, n);
+    RxPos += n;
+    return n;
+}
+
+// ESP-NOW
+
+namespace
+{
+    esp_now_send_cb_t SendCb = nullptr;
+    esp_now_recv_cb_t RecvCb = nullptr;
+    Host::AirFn Air = nullptr;
+    void*       AirContext = nullptr;
+    bool        EspNowInit = false;
+    std::vector<std::vector<uint8_t>> Peers;
+}
+
+void Host::SetAir(AirFn air, void* context)
+{
+    Air = air;
+    AirContext = context;
+}
+
+void Host::Sent(const uint8_t* dest, bool delivered)
+{
+    if (SendCb)
+        SendCb(dest, delivered ? ESP_NOW_SEND_SUCCESS : ESP_NOW_SEND_FAIL);
+}
+
+void Host::Receive(const uint8_t* src, const uint8_t* data, int len)
+{
+    if (RecvCb)
+        RecvCb(src, data, len);
+}
+
+esp_err_t esp_now_init() { EspNowInit = true; return ESP_OK; }
+esp_err_t esp_now_deinit() { EspNowInit = false; Peers.clear(); return ESP_OK; }
+esp_err_t esp_now_register_send_cb(esp_now_send_cb_t cb) { SendCb = cb; return ESP_OK; }
+esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t cb) { RecvCb = cb; return ESP_OK; }
+
+esp_err_t esp_now_add_peer(const esp_now_peer_info_t* peer)
+{
+    if (!EspNowInit)
+        return ESP_ERR_ESPNOW_NOT_INIT;
+    Peers.push_back(std::vector<uint8_t>(peer->peer_addr, peer->peer_addr + ESP_NOW_ETH_ALEN));
+    return ESP_OK;
+}
+
+bool esp_now_is_peer_exist(const uint8_t* peer_addr)
+{
+    for (auto& p : Peers)
+    {
+        if (memcmp(p.data(), peer_addr, ESP_NOW_ETH_ALEN) == 0)
+            return true;
+    }
+    return false;
+}
+
+esp_err_t esp_now_send(const uint8_t* peer_addr, const uint8_t* data, size_t len)
+{
+    if (!EspNowInit)
+        return ESP_ERR_ESPNOW_NOT_INIT;
+    if (!data || len == 0 || len > ESP_NOW_MAX_DATA_LEN)
+        return ESP_ERR_ESPNOW_ARG;
+    if (!esp_now_is_peer_exist(peer_addr))
+        return ESP_ERR_ESPNOW_NOT_FOUND;
+    if (Air)
+        Air(peer_addr, data, len, AirContext);
+    else
+        Host::Sent(peer_addr, false);
+    return ESP_OK;
+}
+
+const char* esp_err_to_name(esp_err_t code)
+{
+    switch (code)
+    {
+    case ESP_OK:                    return "ESP_OK";
+    case ESP_ERR_ESPNOW_NOT_INIT:   return "ESP_ERR_ESPNOW_NOT_INIT";
+    case ESP_ERR_ESPNOW_ARG:        return "ESP_ERR_ESPNOW_ARG";
+    case ESP_ERR_ESPNOW_NOT_FOUND:  return "ESP_ERR_ESPNOW_NOT_FOUND";
+    default:                        return "ESP_FAIL";
+    }
+}
+
+esp_err_t esp_wifi_set_promiscuous(bool) { return ESP_OK; }
+esp_err_t esp_wifi_set_promiscuous_filter(const wifi_promiscuous_filter_t*) { return ESP_OK; }
+esp_err_t esp_wifi_set_promiscuous_rx_cb(wifi_promiscuous_cb_t) { return ESP_OK; }
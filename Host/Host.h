@@ -0,0 +1,32 @@
+#pragma once
+
+#include <Arduino.h>
+
+// host (Linux) build of the libraries, for tests, benchmarks and simulations
+// Arduino.h, FS.h, Preferences.h, WiFi.h, WiFiUdp.h, esp_now.h and esp_wifi.h in this directory
+// stand in for the ESP32 core; these are the controls a test has over them
+namespace Host
+{
+    // clock: real time unless a simulation steps it; delay advances a simulated clock
+    void        SimulateClock(uint64_t startUS = 1000000);
+    void        AdvanceUS(uint32_t us);
+    // esp_random: seeded from the system unless a test wants repeatable runs
+    void        Seed(uint32_t seed);
+
+    // ESP-NOW: every esp_now_send is handed to the air, which decides whether and when
+    // the frame arrives (Receive) and reports the send's outcome (Sent)
+    // with no air, sends fail
+    typedef void (*AirFn)(const uint8_t* dest, const uint8_t* data, int len, void* context);
+    void        SetAir(AirFn air, void* context = nullptr);
+    void        Sent(const uint8_t* dest, bool delivered);                  // ESP-NOW send callback
+    void        Receive(const uint8_t* src, const uint8_t* data, int len);  // ESP-NOW receive callback
+    const uint8_t* MacAddress();                                            // this "device"
+
+    // Preferences: every namespace is kept in memory for the life of the process
+    void        ClearPreferences();
+    uint32_t    PreferenceWrites();         // puts and removes, as flash writes
+
+    // Serial: queue input for the sketch to read; output goes to stdout unless quiet
+    void        SerialInput(const char* s);
+    void        QuietSerial(bool quiet);
+}
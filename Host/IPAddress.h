@@ -0,0 +1,17 @@
+#pragma once
+
+#include <Arduino.h>
+
+class IPAddress
+{
+public:
+    IPAddress() {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : Bytes{ a, b, c, d } {}
+    explicit IPAddress(uint32_t address) { memcpy(Bytes, &address, sizeof(Bytes)); }   // network order
+    operator    uint32_t() const { uint32_t a; memcpy(&a, Bytes, sizeof(a)); return a; }
+    bool        operator==(const IPAddress& rhs) const { return memcmp(Bytes, rhs.Bytes, sizeof(Bytes)) == 0; }
+    uint8_t     operator[](int index) const { return Bytes[index]; }
+    String      toString() const;
+private:
+    uint8_t     Bytes[4] = {};
+};
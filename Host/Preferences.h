@@ -0,0 +1,27 @@
+#pragma once
+
+#include <Arduino.h>
+
+// host NVS: namespaces held in memory (see Host::ClearPreferences)
+// keys are limited to 15 characters like the ESP32's
+class Preferences
+{
+public:
+    bool        begin(const char* name, bool readOnly = false, const char* partitionLabel = nullptr);
+    void        end();
+    bool        clear();
+    bool        remove(const char* key);
+    bool        isKey(const char* key);
+    size_t      putBytes(const char* key, const void* value, size_t len);
+    size_t      putString(const char* key, const char* value);
+    size_t      putString(const char* key, String value) { return putString(key, value.c_str()); }
+    size_t      putUInt(const char* key, uint32_t value) { return putBytes(key, &value, sizeof(value)); }
+    size_t      getBytesLength(const char* key);
+    size_t      getBytes(const char* key, void* buf, size_t maxLen);
+    String      getString(const char* key, String defaultValue = String());
+    uint32_t    getUInt(const char* key, uint32_t defaultValue = 0);
+private:
+    std::string Namespace;
+    bool        Started = false;
+    bool        ReadOnly = false;
+};
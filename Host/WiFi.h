@@ -0,0 +1,18 @@
+#pragma once
+
+#include <Arduino.h>
+#include "IPAddress.h"
+
+// host Wi-Fi: already "connected" to the local machine
+typedef enum { WIFI_OFF, WIFI_STA, WIFI_AP, WIFI_AP_STA } wifi_mode_t;
+
+class HostWiFi
+{
+public:
+    bool        mode(wifi_mode_t m) { Mode = m; return true; }
+    String      macAddress();
+    IPAddress   localIP() { return IPAddress(127, 0, 0, 1); }
+private:
+    wifi_mode_t Mode = WIFI_OFF;
+};
+extern HostWiFi WiFi;
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <Arduino.h>
+#include "IPAddress.h"
+
+// host UDP over a non-blocking POSIX datagram socket
+class WiFiUDP
+{
+public:
+    ~WiFiUDP() { stop(); }
+    uint8_t     begin(uint16_t port);
+    void        stop();
+    int         beginPacket(IPAddress ip, uint16_t port);
+    size_t      write(uint8_t c) { return write(&c, 1); }
+    size_t      write(const uint8_t* buffer, size_t size);
+    int         endPacket();
+    int         parsePacket();
+    int         available() { return RxLen - RxPos; }
+    int         read();
+    int         read(uint8_t* buffer, size_t len);
+    IPAddress   remoteIP() { return RemoteIP; }
+    uint16_t    remotePort() { return RemotePort; }
+private:
+    int         Fd = -1;
+    IPAddress   DestIP;
+    uint16_t    DestPort = 0;
+    std::vector<uint8_t> Tx;
+    uint8_t     Rx[1500];
+    int         RxLen = 0;
+    int         RxPos = 0;
+    IPAddress   RemoteIP;
+    uint16_t    RemotePort = 0;
+    bool        Open();
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <Arduino.h>
+
+// host ESP-NOW: frames go to the air a test sets up (see Host::SetAir)
+typedef int esp_err_t;
+#define ESP_OK                  0
+#define ESP_FAIL                -1
+#define ESP_ERR_ESPNOW_BASE     0x3066
+#define ESP_ERR_ESPNOW_NOT_INIT (ESP_ERR_ESPNOW_BASE + 1)
+#define ESP_ERR_ESPNOW_ARG      (ESP_ERR_ESPNOW_BASE + 2)
+#define ESP_ERR_ESPNOW_NOT_FOUND (ESP_ERR_ESPNOW_BASE + 5)
+#define ESP_NOW_ETH_ALEN        6
+#define ESP_NOW_MAX_DATA_LEN    250
+
+typedef enum { ESP_NOW_SEND_SUCCESS = 0, ESP_NOW_SEND_FAIL } esp_now_send_status_t;
+typedef enum { WIFI_IF_STA = 0, WIFI_IF_AP } wifi_interface_t;
+
+typedef struct
+{
+    uint8_t             peer_addr[ESP_NOW_ETH_ALEN];
+    uint8_t             lmk[16];
+    uint8_t             channel;
+    wifi_interface_t    ifidx;
+    bool                encrypt;
+    void*               priv;
+} esp_now_peer_info_t;
+
+typedef void (*esp_now_send_cb_t)(const uint8_t* mac_addr, esp_now_send_status_t status);
+typedef void (*esp_now_recv_cb_t)(const uint8_t* mac_addr, const uint8_t* data, int data_len);
+
+esp_err_t   esp_now_init();
+esp_err_t   esp_now_deinit();
+esp_err_t   esp_now_register_send_cb(esp_now_send_cb_t cb);
+esp_err_t   esp_now_register_recv_cb(esp_now_recv_cb_t cb);
+esp_err_t   esp_now_add_peer(const esp_now_peer_info_t* peer);
+bool        esp_now_is_peer_exist(const uint8_t* peer_addr);
+esp_err_t   esp_now_send(const uint8_t* peer_addr, const uint8_t* data, size_t len);
+const char* esp_err_to_name(esp_err_t code);
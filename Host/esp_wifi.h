@@ -0,0 +1,15 @@
+#pragma once
+
+#include "esp_now.h"
+
+// host promiscuous mode: nothing is overheard, so no RSSI
+typedef enum { WIFI_PKT_MGMT, WIFI_PKT_CTRL, WIFI_PKT_DATA, WIFI_PKT_MISC } wifi_promiscuous_pkt_type_t;
+typedef struct { signed rssi : 8; } wifi_pkt_rx_ctrl_t;
+typedef struct { wifi_pkt_rx_ctrl_t rx_ctrl; uint8_t payload[0]; } wifi_promiscuous_pkt_t;
+typedef struct { uint32_t filter_mask; } wifi_promiscuous_filter_t;
+#define WIFI_PROMIS_FILTER_MASK_MGMT    (1 << 0)
+typedef void (*wifi_promiscuous_cb_t)(void* buf, wifi_promiscuous_pkt_type_t type);
+
+esp_err_t   esp_wifi_set_promiscuous(bool en);
+esp_err_t   esp_wifi_set_promiscuous_filter(const wifi_promiscuous_filter_t* filter);
+esp_err_t   esp_wifi_set_promiscuous_rx_cb(wifi_promiscuous_cb_t cb);
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "Host.h"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <vector>
+
+// one ESP-NOW channel shared by every station: frames go out one at a time, each taking its airtime,
+// and arrive (or are lost) LatencyUS later; the sender hears the outcome at the same time
+// a test hands Send to Host::SetAir (and its own stations), and calls Service from its loop
+struct Link
+{
+    uint32_t    LatencyUS = 300;
+    uint16_t    LossPM = 0;
+    uint32_t    Frames = 0;
+    uint32_t    Bytes = 0;
+    uint32_t    Lost = 0;
+    struct Event
+    {
+        bool        Receive;        // else the sender's send callback
+        bool        Delivered;
+        uint8_t     Src[6];
+        uint8_t     Dest[6];
+        std::vector<uint8_t> Data;
+    };
+    std::function<void(const Event&)> Deliver;
+    std::multimap<uint64_t, Event> Events;
+    uint64_t    BusyUntilUS = 0;
+    uint32_t    Random = 1;
+
+    // 1 Mbit/s ESP-NOW rate plus preamble, MAC header and ACK
+    static uint32_t AirUS(int len) { return 200 + len * 8; }
+    uint64_t Now() { return (uint64_t)micros(); }
+
+    // callback: the sender is an ESPNAgent, which hears how the send went
+    void Send(const uint8_t* src, const uint8_t* dest, const uint8_t* data, int len, bool callback = true)
+    {
+        Random = Random * 1103515245u + 12345u;
+        bool delivered = (Random >> 16) % 1000 >= LossPM;
+        BusyUntilUS = std::max(Now(), BusyUntilUS) + AirUS(len);
+        ++Frames;
+        Bytes += len;
+        Lost += !delivered;
+        Event e { false, delivered, {}, {}, {} };
+        memcpy(e.Src, src, 6);
+        memcpy(e.Dest, dest, 6);
+        uint64_t at = BusyUntilUS + LatencyUS;
+        if (delivered)
+        {
+            Event r = e;
+            r.Receive = true;
+            r.Data.assign(data, data + len);
+            Events.insert({ at, r });
+        }
+        if (callback)
+            Events.insert({ at, e });
+    }
+
+    void Service()
+    {
+        while (!Events.empty() && Events.begin()->first <= Now())
+        {
+            auto e = Events.begin()->second;
+            Events.erase(Events.begin());
+            Deliver(e);
+        }
+    }
+};
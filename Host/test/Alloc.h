@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// heap use, counted by replacing the global operator new; include from one file per program
+uint32_t Allocations = 0;
+size_t HeapBytes = 0;
+
+void* operator new(size_t size)
+{
+    ++Allocations;
+    HeapBytes += size;
+    void* p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+// checks stay on in optimized builds, unlike assert
+#define CHECK(cond) \
+    do { if (!(cond)) { fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); exit(1); } } while (0)
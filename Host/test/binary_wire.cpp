@@ -0,0 +1,108 @@
+// binary command negotiation between two roots joined by LoopbackAgents, across connection blips
+// on either side; the sides must always agree on whether binary is in use
+#include "Host.h"
+#include "LoopbackAgent.h"
+#include "Test.h"
+
+constexpr OMPropDef Props[] =
+{
+    { 'a', "A", OMT_LONG,   OMF_NONE, 0, 1000 },
+    { 's', "S", OMT_STRING, OMF_NONE },
+    { 'q', "Q", OMT_LONG,   OMF_NONE, 0, 60000, 0, nullptr, 10 },
+    { }
+};
+constexpr OMObjDef Objs[] =
+{
+    { 'x', "X", nullptr, Props, nullptr },
+    { }
+};
+
+Root Dev(true, 'R', "Dev"), Ctl(false, 'R', "Ctl");
+LoopbackAgent DevAgent(nullptr, &Dev), CtlAgent(nullptr, &Ctl);
+
+void Pump()
+{
+    for (int i = 0; i < 20; ++i)
+    {
+        CtlAgent.Run();
+        DevAgent.Run();
+        Ctl.Run();
+        Dev.Run();
+    }
+}
+
+OMPropertyLong* Long(Root& root) { return (OMPropertyLong*)root.GetObject('x')->GetProperty('a'); }
+
+// a value from each side arrives
+void CheckSync(long value)
+{
+    Long(Ctl)->SetSend(value);
+    Pump();
+    CHECK(Long(Dev)->Value == value);
+    Long(Dev)->SetSend(value + 1);
+    Pump();
+    CHECK(Long(Ctl)->Value == value + 1);
+}
+
+// a stepped value set by the controller is held the same on both sides, whichever wire format carries it
+void CheckSteps(long value, long stepped)
+{
+    auto q = (OMPropertyLong*)Ctl.GetObject('x')->GetProperty('q');
+    q->SetSend(value);
+    Pump();
+    CHECK(q->Value == stepped);
+    CHECK(((OMPropertyLong*)Dev.GetObject('x')->GetProperty('q'))->Value == stepped);
+}
+
+void Blip(Root& root)
+{
+    root.ConnectionChanged(false);
+    root.ConnectionChanged(true);
+    Pump();
+}
+
+int main()
+{
+    Host::QuietSerial(true);
+    Dev.AddObjects(Objs);
+    Ctl.AddObjects(Objs);
+    Dev.BinaryWire = Ctl.BinaryWire = true;
+    CtlAgent.Setup(&DevAgent);
+    Dev.Setup(&DevAgent);
+    Ctl.Setup(&CtlAgent);
+    Pump();
+    CHECK(Dev.BinaryPeer && Ctl.BinaryPeer);
+    CheckSync(100);
+    CheckSteps(12347, 12350);
+    CheckSteps(12344, 12340);
+    CheckSteps(59999, 60000);
+
+    // the controller drops and regains the device: its new offer is answered
+    Blip(Ctl);
+    CHECK(Dev.BinaryPeer && Ctl.BinaryPeer);
+    CheckSync(200);
+
+    // the device sees the link drop; the controller may not have, and makes no new offer
+    Blip(Dev);
+    CHECK(Dev.BinaryPeer && Ctl.BinaryPeer);
+    CheckSync(300);
+
+    // a controller without binary takes the device back to text
+    Ctl.BinaryWire = false;
+    Blip(Ctl);
+    CHECK(!Dev.BinaryPeer && !Ctl.BinaryPeer);
+    CheckSync(400);
+    CheckSteps(12347, 12350);
+    CheckSteps(12344, 12340);
+    Ctl.BinaryWire = true;
+    Blip(Ctl);
+    CHECK(Dev.BinaryPeer && Ctl.BinaryPeer);
+
+    // a device with a different tree stays on text
+    Dev.GetObject('x')->AddProperty(new OMPropertyLong('z', "Z", 0, 1, 0));
+    Dev.Setup(&DevAgent);
+    Blip(Ctl);
+    CHECK(!Dev.BinaryPeer && !Ctl.BinaryPeer);
+    CheckSync(500);
+    return 0;
+}
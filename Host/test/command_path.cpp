@@ -0,0 +1,238 @@
+// the command path end to end on the Falcon tree: a controller and a device joined by LoopbackAgents,
+// with text and with binary commands, under slider sweep, ?R resync and preference save/load workloads
+// reports commands/s, bytes/frame, heap allocations per command and p50/p99 latency
+// allocations are those of the host build: String keeps the core's short string capacity (String::SsoMax),
+// but longer strings grow as std::string does, and the host's containers are libstdc++'s
+#include "Host.h"
+#include "LoopbackAgent.h"
+#include "OMPrefs.h"
+#include "Debug.h"
+#include "Test.h"
+#include "Alloc.h"
+#include <algorithm>
+#include <chrono>
+
+// the application's connectors, standing in for the hardware
+class HardwareConnector : public OMConnector
+{
+public:
+    void Init(OMObject* obj) override {}
+    void Push(OMObject* obj, OMProperty* prop) override { ++Pushes; }
+    void Pull(OMObject* obj, OMProperty* prop) override {}
+    uint32_t Pushes = 0;
+};
+HardwareConnector LightConn, GroupConn, RampConn, RectennaConn, SoundConn;
+
+#include "OMDef.h"
+
+uint64_t NowNS()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct Samples
+{
+    std::vector<uint32_t> US;
+    void        Add(uint64_t ns) { US.push_back(ns / 1000); }
+    uint32_t    Percentile(int percent)
+    {
+        if (US.empty())
+            return 0;
+        std::sort(US.begin(), US.end());
+        return US[std::min(US.size() - 1, US.size() * percent / 100)];
+    }
+};
+
+struct Falcon
+{
+    Falcon(bool binary) : Dev(true, 'R', "Falcon"), Ctl(false, 'R', "Remote"), DevAgent(nullptr, &Dev), CtlAgent(nullptr, &Ctl)
+    {
+        for (auto root : { &Dev, &Ctl })
+        {
+            root->AddObjects(Objects);
+            root->AddProperties(RootProps);
+            root->BinaryWire = binary;
+        }
+        CtlAgent.Setup(&DevAgent);
+        Dev.Setup(&DevAgent);
+        Ctl.Setup(&CtlAgent);
+        // connect, negotiate and take the device's values
+        for (int i = 0; i < 100; ++i)
+            Pump();
+        CHECK(Dev.BinaryPeer == binary && Ctl.BinaryPeer == binary);
+    }
+    Root            Dev, Ctl;
+    LoopbackAgent   DevAgent, CtlAgent;
+
+    void Pump()
+    {
+        CtlAgent.Run();
+        DevAgent.Run();
+        Ctl.Run();
+        Dev.Run();
+    }
+    // until nothing moves
+    void Settle()
+    {
+        uint32_t frames;
+        do
+        {
+            frames = CtlAgent.FramesOut + DevAgent.FramesOut;
+            for (int i = 0; i < 4; ++i)
+                Pump();
+        } while (frames != CtlAgent.FramesOut + DevAgent.FramesOut || CtlAgent.InputDepth() || DevAgent.InputDepth());
+    }
+};
+
+struct Stats
+{
+    Stats(Falcon& f, Agent& sender, Agent& receiver) : F(f), Sender(sender), Receiver(receiver)
+    {
+        Start = NowNS();
+        Allocs = Allocations;
+        Applied = receiver.InputCount;
+        Frames = sender.OutputFrames;
+        Bytes = sender.OutputBytes;
+    }
+    Falcon&     F;
+    Agent&      Sender;
+    Agent&      Receiver;
+    uint64_t    Start;
+    uint32_t    Allocs, Applied, Frames, Bytes;
+    Samples     Latency;
+
+    void Report(const char* name)
+    {
+        double seconds = (NowNS() - Start) / 1e9;
+        uint32_t applied = Receiver.InputCount - Applied;
+        uint32_t frames = Sender.OutputFrames - Frames;
+        CHECK(applied > 0 && frames > 0);
+        printf("%-14s %s: %6u commands, %8.0f commands/s, %5.1f bytes/frame, %4.2f allocations/command, latency p50 %u us p99 %u us\n",
+            name, F.Dev.BinaryPeer ? "binary" : "text  ", applied, applied / seconds, (double)(Sender.OutputBytes - Bytes) / frames,
+            (double)(Allocations - Allocs) / applied, Latency.Percentile(50), Latency.Percentile(99));
+    }
+};
+
+// the remote drags the color sliders of four lights; latency runs from the controller's SetSend
+// to the device's change notification for that value (later values overtake coalesced ones)
+const char Sliders[] = "elwd";
+const uint32_t SweepSteps = 5000;
+std::vector<uint64_t> SentNS[4];
+Samples* SweepLatency;
+
+OMPropertyLong* Color(Root& root, int slider)
+{
+    return (OMPropertyLong*)root.GetObject('l')->GetObject(Sliders[slider])->GetProperty('c');
+}
+
+void SliderChanged(OMNode* node, void* context)
+{
+    auto slider = (intptr_t)context;
+    auto value = ((OMPropertyLong*)node)->Value;
+    if (value > 0 && value <= (long)SweepSteps && SentNS[slider][value])
+    {
+        SweepLatency->Add(NowNS() - SentNS[slider][value]);
+        SentNS[slider][value] = 0;
+    }
+}
+
+void Sweep(Falcon& f)
+{
+    for (int s = 0; s < 4; ++s)
+    {
+        SentNS[s].assign(SweepSteps + 1, 0);
+        f.Dev.Subscribe(Color(f.Dev, s), SliderChanged, (void*)(intptr_t)s);
+    }
+    Stats stats(f, f.CtlAgent, f.DevAgent);
+    SweepLatency = &stats.Latency;
+    for (uint32_t step = 1; step <= SweepSteps; ++step)
+    {
+        for (int s = 0; s < 4; ++s)
+        {
+            SentNS[s][step] = NowNS();
+            Color(f.Ctl, s)->SetSend(step);
+        }
+        f.Pump();
+    }
+    f.Settle();
+    stats.Report("slider sweep");
+    for (int s = 0; s < 4; ++s)
+    {
+        CHECK(Color(f.Dev, s)->Value == (long)SweepSteps);
+        f.Dev.Unsubscribe(Color(f.Dev, s), SliderChanged, (void*)(intptr_t)s);
+    }
+}
+
+// the remote asks for every value; latency runs from the request to the last value applied
+void Resync(Falcon& f)
+{
+    Color(f.Dev, 0)->Value = 123;
+    Stats stats(f, f.DevAgent, f.CtlAgent);
+    uint32_t values = 0;
+    for (int i = 0; i < 200; ++i)
+    {
+        uint32_t applied = f.CtlAgent.InputCount;
+        uint64_t start = NowNS();
+        f.Ctl.SendCmd("?R");
+        f.Settle();
+        stats.Latency.Add(NowNS() - start);
+        values = f.CtlAgent.InputCount - applied;
+    }
+    stats.Report("?R resync");
+    CHECK(values > 100);
+    CHECK(Color(f.Ctl, 0)->Value == 123);
+}
+
+// the device saves its tree after changes, and loads it back; one command per save or load
+void Preferences(Falcon& f)
+{
+    Host::ClearPreferences();
+    Samples save, load;
+    uint32_t allocs = Allocations;
+    uint32_t writes = Host::PreferenceWrites();
+    uint64_t start = NowNS();
+    const int rounds = 200;
+    for (int i = 0; i < rounds; ++i)
+    {
+        for (int s = 0; s < 4; ++s)
+            Color(f.Dev, s)->Value = i * 4 + s;
+        uint64_t t = NowNS();
+        OMPrefs().Save(&f.Dev, true);
+        save.Add(NowNS() - t);
+        for (int s = 0; s < 4; ++s)
+            Color(f.Dev, s)->Value = 0;
+        t = NowNS();
+        OMPrefs().Load(&f.Dev, true);
+        load.Add(NowNS() - t);
+        for (int s = 0; s < 4; ++s)
+            CHECK(Color(f.Dev, s)->Value == i * 4 + s);
+    }
+    double seconds = (NowNS() - start) / 1e9;
+
+    // a property saved on its own, as autosave does, unchanged and not last in its object's blob
+    auto rect = f.Dev.GetObject('a');
+    OMPrefs().Save(rect, false);
+    uint32_t rewrites = OMPrefs::Writes, unchanged = OMPrefs::Unchanged;
+    OMPrefs().Save(rect->GetProperty('s'));
+    CHECK(OMPrefs::Writes == rewrites && OMPrefs::Unchanged == unchanged + 1);
+
+    printf("%-14s       : %6u saves and loads, %8.0f per second, %4.1f flash writes/save, %5.1f allocations each, "
+        "save p50 %u us p99 %u us, load p50 %u us p99 %u us\n",
+        "preferences", rounds * 2, rounds * 2 / seconds, (double)(Host::PreferenceWrites() - writes) / rounds,
+        (double)(Allocations - allocs) / (rounds * 2), save.Percentile(50), save.Percentile(99), load.Percentile(50), load.Percentile(99));
+}
+
+int main()
+{
+    Host::QuietSerial(true);
+    printf("allocations: host build; String holds up to %u characters without the heap, as on the core\n", String::SsoMax);
+    for (bool binary : { false, true })
+    {
+        Falcon f(binary);
+        Sweep(f);
+        Resync(f);
+    }
+    Falcon f(false);
+    Preferences(f);
+    return 0;
+}
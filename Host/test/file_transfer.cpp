@@ -0,0 +1,191 @@
+// file transfer between two ESPNAgents over a simulated ESP-NOW link, against
+// a model of the stop-and-wait scheme it replaced run over the same link
+// reports throughput in simulated time; the received files must match
+#include "Host.h"
+#include "ESPNAgent.h"
+#include "Test.h"
+#include "Air.h"
+
+uint8_t CtlMac[6] = { 0x24, 0x0A, 0xC4, 0x00, 0x00, 0x01 };
+uint8_t DevMac[6] = { 0x24, 0x0A, 0xC4, 0x00, 0x00, 0x02 };
+const uint32_t FileSize = 64 * 1024;
+const uint32_t TickUS = 200;            // loop period of both ends
+const uint64_t LimitUS = 60000000;
+
+Link Air;
+
+// the test's own directory for each end's flash
+struct TempFS
+{
+    TempFS() { Dir = mkdtemp(Template); }
+    ~TempFS() { std::string cmd = std::string("rm -rf ") + Dir; (void)system(cmd.c_str()); }
+    char        Template[32] = "/tmp/omfileXXXXXX";
+    const char* Dir;
+    std::vector<uint8_t> Read(const char* name)
+    {
+        std::vector<uint8_t> data;
+        FILE* f = fopen((std::string(Dir) + name).c_str(), "rb");
+        if (!f)
+            return data;
+        int c;
+        while ((c = fgetc(f)) != EOF)
+            data.push_back(c);
+        fclose(f);
+        return data;
+    }
+};
+
+// the previous scheme: the sender sends packet n from its loop and waits for the receiver's ACK of it
+// the receiver ACKs from its receive callback; a failed send is retried from the loop
+double StopAndWait(const std::vector<uint8_t>& file)
+{
+    const uint16_t packetSize = 240;
+    const uint32_t count = (file.size() + packetSize - 1) / packetSize;
+    uint32_t next = 0;              // 0: start packet
+    uint32_t received = 0;
+    bool sendDue = true;
+    Air.Deliver = [&](const Link::Event& e) {
+        bool toDev = memcmp(e.Dest, DevMac, 6) == 0;
+        if (!e.Receive)
+        {
+            // a lost packet is resent; so is one whose ACK was lost, standing in for a timeout
+            if (!e.Delivered)
+                sendDue = true;
+            return;
+        }
+        if (toDev)
+        {
+            // receiver: data in order, then ACK
+            uint32_t n;
+            memcpy(&n, e.Data.data() + 4, 4);
+            if (n == received)
+                ++received;
+            uint8_t ack[5] = { '3' };
+            memcpy(ack + 1, &n, 4);
+            Air.Send(DevMac, CtlMac, ack, sizeof(ack));
+        }
+        else
+        {
+            uint32_t n;
+            memcpy(&n, e.Data.data() + 1, 4);
+            if (n == next)
+            {
+                ++next;
+                sendDue = true;
+            }
+        }
+    };
+    uint64_t start = Air.Now();
+    while (received <= count && Air.Now() - start < LimitUS)
+    {
+        Air.Service();
+        if (sendDue && next <= count)
+        {
+            sendDue = false;
+            uint8_t packet[8 + packetSize] = { '2' };
+            memcpy(packet + 4, &next, 4);
+            uint32_t len = next == 0 ? 16 : std::min<uint32_t>(packetSize, file.size() - (next - 1) * packetSize);
+            Air.Send(CtlMac, DevMac, packet, 8 + len);
+        }
+        Host::AdvanceUS(TickUS);
+    }
+    CHECK(received == count + 1);
+    return (Air.Now() - start) / 1e6;
+}
+
+struct FileRoot : public Root
+{
+    FileRoot(bool isDevice) : Root(isDevice, 'R', isDevice ? "Dev" : "Ctl") {}
+    String      Received;
+    void        ReceivedFile(String fileName) override { Received = fileName; }
+};
+
+TempFS CtlDir, DevDir;
+FS CtlFS(CtlDir.Dir), DevFS(DevDir.Dir);
+FileRoot Ctl(false), Dev(true);
+ESPNAgent CtlAgent(&CtlFS, &Ctl), DevAgent(&DevFS, &Dev);
+
+void Tick()
+{
+    Air.Service();
+    CtlAgent.Run();
+    DevAgent.Run();
+    Ctl.Run();
+    Dev.Run();
+    Host::AdvanceUS(TickUS);
+}
+
+// the controller sends name to the device; seconds, or 0 if it never arrived
+double Transfer(const char* name)
+{
+    Dev.Received = "";
+    uint32_t frames = Air.Frames, lost = Air.Lost;
+    uint64_t start = Air.Now();
+    CtlAgent.StartFileTransfer(String("/") + name);
+    while (Dev.Received != name && Air.Now() - start < LimitUS)
+        Tick();
+    double seconds = (Air.Now() - start) / 1e6;
+    // let the final ACK reach the sender
+    for (int i = 0; i < 1000; ++i)
+        Tick();
+    printf("  %u frames, %u lost\n", Air.Frames - frames, Air.Lost - lost);
+    return Dev.Received == name ? seconds : 0;
+}
+
+int main()
+{
+    Host::QuietSerial(true);
+    Host::SimulateClock();
+    Host::Seed(9);
+
+    std::vector<uint8_t> file(FileSize);
+    for (auto& b : file)
+        b = esp_random();
+    FILE* f = fopen((std::string(CtlDir.Dir) + "/image.bin").c_str(), "wb");
+    CHECK(f && fwrite(file.data(), 1, file.size(), f) == file.size());
+    fclose(f);
+
+    double oldSeconds = StopAndWait(file);
+    printf("stop-and-wait: %u bytes in %.2f s, %.1f KB/s\n", FileSize, oldSeconds, FileSize / oldSeconds / 1024);
+
+    Air.Deliver = [](const Link::Event& e) {
+        if (e.Receive)
+            Host::Receive(e.Src, e.Data.data(), e.Data.size());
+        else
+            Host::Sent(e.Dest, e.Delivered);
+    };
+    // frames to one end come from the other
+    Host::SetAir([](const uint8_t* dest, const uint8_t* data, int len, void*) {
+        Air.Send(memcmp(dest, DevMac, 6) == 0 ? CtlMac : DevMac, dest, data, len);
+    });
+    CtlAgent.Setup(DevMac);
+    DevAgent.Setup(CtlMac);
+    Ctl.Setup(&CtlAgent);
+    Dev.Setup(&DevAgent);
+    for (int i = 0; i < 100; ++i)
+        Tick();
+
+    // the device allocates its receive buffers once a start arrives, and takes the resent start
+    std::vector<uint8_t> small(file.begin(), file.begin() + 1000);
+    f = fopen((std::string(CtlDir.Dir) + "/small.bin").c_str(), "wb");
+    CHECK(f && fwrite(small.data(), 1, small.size(), f) == small.size());
+    fclose(f);
+    CHECK(Transfer("small.bin") > 0);
+    CHECK(DevDir.Read("/small.bin") == small);
+
+    double seconds = Transfer("image.bin");
+    CHECK(seconds > 0);
+    CHECK(DevDir.Read("/image.bin") == file);
+    printf("sliding window: %u bytes in %.2f s, %.1f KB/s, %.1fx stop-and-wait\n",
+        FileSize, seconds, FileSize / seconds / 1024, oldSeconds / seconds);
+    CHECK(seconds < oldSeconds);
+
+    // on a lossy link the window recovers from the ACK bitmaps
+    Air.LossPM = 20;
+    DevFS.remove("/image.bin");
+    seconds = Transfer("image.bin");
+    CHECK(seconds > 0);
+    CHECK(DevDir.Read("/image.bin") == file);
+    printf("sliding window, 2%% loss: %.2f s, %.1f KB/s\n", seconds, FileSize / seconds / 1024);
+    return 0;
+}
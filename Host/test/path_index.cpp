@@ -0,0 +1,106 @@
+// path resolution through OMPathIndex against the tree walk it replaces
+// both must find the same nodes; the timings are printed for comparison
+#include "Host.h"
+#include "OMObject.h"
+#include "Test.h"
+#include <algorithm>
+#include <chrono>
+
+const char Ids[] = "abcdefghijklmnopqrstuvwxyz";
+const int Rounds = 5;       // alternating walk and index, keeping the best of each
+const int Lookups = 200000;
+
+struct Tree
+{
+    Tree(int fan, int depth, int props) : Fan(fan), Depth(depth), Props(props), R(true, 'R', "R") { Build(&R, "", 0); }
+    int         Fan;        // objects under each object
+    int         Depth;
+    int         Props;      // properties on each object
+    Root        R;
+    std::vector<String> ObjPaths;
+
+    void Build(OMObject* obj, const String& path, int depth)
+    {
+        for (int i = 0; i < Props; ++i)
+            obj->AddProperty(new OMPropertyLong('A' + i, "p", 0, 100, 0));
+        if (depth == Depth)
+            return;
+        for (int i = 0; i < Fan; ++i)
+        {
+            auto o = new OMObject(Ids[i], "o", nullptr);
+            obj->AddObject(o);
+            String sub = path + Ids[i];
+            ObjPaths.push_back(sub);
+            Build(o, sub, depth + 1);
+        }
+    }
+
+    // every object and property, in a shuffled order as commands arrive; ns per lookup
+    // found is filled in the tree's order, for comparison
+    double Resolve(std::vector<OMNode*>& found)
+    {
+        size_t per = Props + 1;
+        std::vector<uint32_t> order(ObjPaths.size() * per);
+        for (size_t i = 0; i < order.size(); ++i)
+            order[i] = i;
+        srand(1);
+        std::random_shuffle(order.begin(), order.end());
+        found.assign(order.size(), nullptr);
+        uint32_t count = 0;
+        auto start = std::chrono::steady_clock::now();
+        while (count < Lookups)
+        {
+            for (auto i : order)
+            {
+                auto& path = ObjPaths[i / per];
+                auto p = i % per;
+                found[i] = p ? (OMNode*)R.PropertyFromPath(path, 'A' + p - 1) : R.ObjectFromPath(path);
+            }
+            count += order.size();
+        }
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+    }
+
+    void Compare(const char* name)
+    {
+        std::vector<OMNode*> walked, indexed;
+        double walkNS = 1e9, indexNS = 1e9;
+        for (int round = 0; round < Rounds; ++round)
+        {
+            if (R.GetPathIndex())
+                R.GetPathIndex()->Clear();
+            walkNS = std::min(walkNS, Resolve(walked));
+            R.BuildPathIndex();
+            CHECK(R.GetPathIndex());
+            indexNS = std::min(indexNS, Resolve(indexed));
+        }
+
+        CHECK(walked == indexed);
+        for (size_t i = 0; i < ObjPaths.size(); ++i)
+        {
+            auto o = indexed[i * (Props + 1)];
+            CHECK(o && o->IsObject() && o->GetPath() == ObjPaths[i]);
+            for (int p = 1; p <= Props; ++p)
+                CHECK(indexed[i * (Props + 1) + p] && indexed[i * (Props + 1) + p]->Parent == o);
+        }
+        // an unknown id ends the path at the last node found, either way
+        String bad = ObjPaths.back() + "~";
+        auto deepest = R.ObjectFromPath(ObjPaths.back());
+        CHECK(R.ObjectFromPath(bad) == deepest);
+        R.GetPathIndex()->Clear();
+        CHECK(R.ObjectFromPath(bad) == deepest);
+
+        printf("%s: %d objects of %d properties: tree walk %.0f ns, path index %.0f ns per lookup\n",
+            name, (int)ObjPaths.size(), Props, walkNS, indexNS);
+    }
+};
+
+int main()
+{
+    Host::QuietSerial(true);
+    // about the size of a real tree
+    Tree(8, 2, 12).Compare("typical");
+    // wide levels, where the walk's linear scans grow
+    Tree(26, 1, 26).Compare("wide");
+    return 0;
+}
@@ -0,0 +1,70 @@
+// a device application whose Run hides Root::Run and never calls it, as older applications did:
+// change notifications and autosave still happen, driven by the agent
+#include "Host.h"
+#include "LoopbackAgent.h"
+#include "OMPrefs.h"
+#include "Test.h"
+
+constexpr OMPropDef Props[] =
+{
+    { 'a', "A", OMT_LONG, OMF_PERSIST, 0, 1000 },
+    { }
+};
+constexpr OMObjDef Objs[] =
+{
+    { 'x', "X", nullptr, Props, nullptr },
+    { }
+};
+
+struct AppRoot : public Root
+{
+    AppRoot() : Root(true, 'R', "Dev") {}
+    void        Run() { ++Runs; }
+    uint32_t    Runs = 0;
+};
+
+AppRoot Dev;
+Root Ctl(false, 'R', "Ctl");
+LoopbackAgent DevAgent(nullptr, &Dev), CtlAgent(nullptr, &Ctl);
+
+uint32_t Notified = 0;
+void Changed(OMNode* node, void* context) { ++Notified; }
+
+void Pump(uint32_t ms)
+{
+    for (uint32_t i = 0; i < ms; ++i)
+    {
+        CtlAgent.Run();
+        DevAgent.Run();
+        Ctl.Run();
+        Dev.Run();
+        Host::AdvanceUS(1000);
+    }
+}
+
+int main()
+{
+    Host::QuietSerial(true);
+    Host::SimulateClock();
+    Host::ClearPreferences();
+    Dev.AddObjects(Objs);
+    Ctl.AddObjects(Objs);
+    CtlAgent.Setup(&DevAgent);
+    Dev.Setup(&DevAgent);
+    Ctl.Setup(&CtlAgent);
+    Pump(100);
+
+    auto a = Dev.GetObject('x')->GetProperty('a');
+    Dev.Subscribe(a, Changed);
+    uint32_t writes = OMPrefs::Writes;
+    ((OMPropertyLong*)Ctl.GetObject('x')->GetProperty('a'))->SetSend(42);
+    Pump(100);
+    CHECK(((OMPropertyLong*)a)->Value == 42);
+    CHECK(Notified == 1);
+    // saved once the change has been quiet for PersistQuietMS
+    CHECK(OMPrefs::Writes == writes);
+    Pump(Dev.PersistQuietMS);
+    CHECK(OMPrefs::Writes == writes + 1 && Dev.AutoSaves == 1);
+    CHECK(Dev.Runs > 0);
+    return 0;
+}
@@ -0,0 +1,200 @@
+// a controller driving eight devices through ESPNAgent::RunAll over one simulated channel
+// the devices are plain Agents on the air (ESPNAgents would all share the controller's MAC as their peer)
+// reports each agent's memory and the commands each device applied, against a fixed order of Runs
+#include "Host.h"
+#include "ESPNAgent.h"
+#include "Test.h"
+#include "Air.h"
+#include "Alloc.h"
+
+const int Peers = 8;
+const uint32_t TickUS = 200;
+
+constexpr OMPropDef Props[] =
+{
+    { 'a', "A", OMT_LONG, OMF_NONE, 0, 100000 },
+    { 'b', "B", OMT_LONG, OMF_NONE, 0, 100000 },
+    { 'c', "C", OMT_LONG, OMF_NONE, 0, 100000 },
+    { 'd', "D", OMT_LONG, OMF_NONE, 0, 100000 },
+    { }
+};
+constexpr OMObjDef Objs[] =
+{
+    { 'x', "X", nullptr, Props, nullptr },
+    { }
+};
+
+uint8_t CtlMac[6] = { 0x24, 0x0A, 0xC4, 0x00, 0x01, 0x00 };
+uint8_t DevMacs[Peers][6];
+
+Link Air;
+
+// a device: the sequencing and command path of Agent, sending straight to the air
+class SimDevice : public Agent
+{
+public:
+    SimDevice(Root* proot, const uint8_t* mac) : Agent(nullptr, proot), Mac(mac) { EnableSequencing(); }
+    bool Send(const uint8_t *pData, int len) override { Air.Send(Mac, CtlMac, pData, len, false); return true; }
+    void StartFileTransfer(String filePath) override {}
+    void Receive(const uint8_t *pData, int len)
+    {
+        if (pData[0] == OMS_FRAME)
+            ReceiveSequenced(pData, len);
+        else if (pData[0] == OMA_FRAME)
+            ReceiveAck(pData, len);
+    }
+    const uint8_t* Mac;
+};
+
+Root* CtlRoots[Peers];
+ESPNAgent* CtlAgents[Peers];
+Root* DevRoots[Peers];
+SimDevice* Devs[Peers];
+
+void Deliver(const Link::Event& e)
+{
+    if (!e.Receive)
+        Host::Sent(e.Dest, true);
+    else if (memcmp(e.Dest, CtlMac, 6) == 0)
+        Host::Receive(e.Src, e.Data.data(), e.Data.size());
+    else
+    {
+        for (int i = 0; i < Peers; ++i)
+        {
+            if (memcmp(e.Dest, DevMacs[i], 6) == 0)
+                Devs[i]->Receive(e.Data.data(), e.Data.size());
+        }
+    }
+}
+
+// every controller root keeps all four properties of its device changing;
+// the shared in-flight window is the bottleneck
+// returns the commands each device applied over the run
+std::vector<uint32_t> Drive(bool runAll, uint32_t ms)
+{
+    std::vector<uint32_t> start(Peers);
+    for (int i = 0; i < Peers; ++i)
+        start[i] = Devs[i]->InputCount;
+    long value = 0;
+    for (uint64_t end = micros() + ms * 1000ull; micros() < end; )
+    {
+        Air.Service();
+        ++value;
+        for (int i = 0; i < Peers; ++i)
+        {
+            auto obj = CtlRoots[i]->GetObject('x');
+            for (auto p : obj->Properties)
+                ((OMPropertyLong*)p)->SetSend(value % 100000);
+            CtlRoots[i]->Run();
+        }
+        if (runAll)
+            ESPNAgent::RunAll();
+        else
+        {
+            for (auto a : CtlAgents)
+                a->Run();
+        }
+        for (int i = 0; i < Peers; ++i)
+        {
+            Devs[i]->Run();
+            DevRoots[i]->Run();
+        }
+        Host::AdvanceUS(TickUS);
+    }
+    std::vector<uint32_t> applied(Peers);
+    for (int i = 0; i < Peers; ++i)
+        applied[i] = Devs[i]->InputCount - start[i];
+    return applied;
+}
+
+// Jain's index: 1 when every device got the same share, 1/n when one got everything
+double Fairness(const std::vector<uint32_t>& applied)
+{
+    double sum = 0, squares = 0;
+    for (auto n : applied)
+    {
+        sum += n;
+        squares += (double)n * n;
+    }
+    return squares == 0 ? 0 : sum * sum / (applied.size() * squares);
+}
+
+void Report(const char* name, const std::vector<uint32_t>& applied, uint32_t ms)
+{
+    uint32_t total = 0, least = UINT32_MAX, most = 0;
+    for (auto n : applied)
+    {
+        total += n;
+        least = std::min(least, n);
+        most = std::max(most, n);
+    }
+    printf("%s: %.0f commands/s in all, per device %u to %u, fairness %.3f\n",
+        name, total * 1000.0 / ms, least, most, Fairness(applied));
+}
+
+int main()
+{
+    Host::QuietSerial(true);
+    Host::SimulateClock();
+    Host::Seed(12);
+    Air.Deliver = Deliver;
+    Host::SetAir([](const uint8_t* dest, const uint8_t* data, int len, void*) { Air.Send(CtlMac, dest, data, len); });
+
+    size_t setupHeap = 0;
+    for (int i = 0; i < Peers; ++i)
+    {
+        memcpy(DevMacs[i], CtlMac, 6);
+        DevMacs[i][5] = i + 1;
+        DevRoots[i] = new Root(true, 'R', "Dev");
+        DevRoots[i]->AddObjects(Objs);
+        Devs[i] = new SimDevice(DevRoots[i], DevMacs[i]);
+        DevRoots[i]->Setup(Devs[i]);
+
+        CtlRoots[i] = new Root(false, 'R', "Ctl");
+        CtlRoots[i]->AddObjects(Objs);
+        size_t before = HeapBytes;
+        CtlAgents[i] = new ESPNAgent(nullptr, CtlRoots[i]);
+        CtlAgents[i]->Setup(DevMacs[i]);
+        setupHeap += HeapBytes - before - sizeof(ESPNAgent);
+        CtlRoots[i]->Setup(CtlAgents[i]);
+    }
+    printf("per agent: %zu bytes of ESPNAgent, %zu more from the heap at setup\n", sizeof(ESPNAgent), setupHeap / Peers);
+
+    const uint32_t ms = 2000;
+    auto fixed = Drive(false, ms);
+    Report("fixed order", fixed, ms);
+    auto rotated = Drive(true, ms);
+    Report("RunAll", rotated, ms);
+
+    for (int i = 0; i < Peers; ++i)
+    {
+        CHECK(rotated[i] > 0);
+        CHECK(CtlAgents[i]->FramesAbandoned == 0);
+    }
+    CHECK(Fairness(rotated) > 0.95);
+    CHECK(Fairness(rotated) >= Fairness(fixed) - 0.01);
+    // the devices' trees end up with the controllers' values
+    Drive(true, 10);
+    for (int n = 0; n < 1000; ++n)
+    {
+        Air.Service();
+        for (int i = 0; i < Peers; ++i)
+            CtlRoots[i]->Run();
+        ESPNAgent::RunAll();
+        for (int i = 0; i < Peers; ++i)
+        {
+            Devs[i]->Run();
+            DevRoots[i]->Run();
+        }
+        Host::AdvanceUS(TickUS);
+    }
+    for (int i = 0; i < Peers; ++i)
+    {
+        for (char id = 'a'; id <= 'd'; ++id)
+        {
+            auto want = ((OMPropertyLong*)CtlRoots[i]->GetObject('x')->GetProperty(id))->Value;
+            CHECK(((OMPropertyLong*)DevRoots[i]->GetObject('x')->GetProperty(id))->Value == want);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,149 @@
+// two Agents sequencing command frames over a channel the test controls frame by frame:
+// frames held past a gap the sender gives up on, and a stale ACK from before the peer restarted
+#include "Host.h"
+#include "Agent.h"
+#include "Test.h"
+#include <deque>
+
+constexpr OMPropDef Props[] =
+{
+    { 'a', "A", OMT_LONG, OMF_NONE, 0, 100000 },
+    { }
+};
+constexpr OMObjDef Objs[] =
+{
+    { 'x', "X", nullptr, Props, nullptr },
+    { }
+};
+
+typedef std::vector<uint8_t> Frame;
+
+// frames sent wait in Out for the test to deliver, drop or keep
+class SeqAgent : public Agent
+{
+public:
+    SeqAgent(Root* proot) : Agent(nullptr, proot) { EnableSequencing(); }
+    bool Send(const uint8_t *pData, int len) override { Out.emplace_back(pData, pData + len); return true; }
+    void StartFileTransfer(String filePath) override {}
+    void Receive(const Frame& f)
+    {
+        if (f[0] == OMS_FRAME)
+            ReceiveSequenced(f.data(), f.size());
+        else if (f[0] == OMA_FRAME)
+            ReceiveAck(f.data(), f.size());
+    }
+    std::deque<Frame> Out;
+};
+
+struct End
+{
+    End() : R(true, 'R', "R"), A(&R) { R.AddObjects(Objs); R.Setup(&A); }
+    Root        R;
+    SeqAgent    A;
+    long        Value() { return ((OMPropertyLong*)R.GetObject('x')->GetProperty('a'))->Value; }
+    void        Run() { A.Run(); R.Run(); }
+};
+
+// a command frame from e, setting its peer's value
+void SendValue(End& e, long value)
+{
+    e.A.SendCmd(String("=xa") + String(value));
+    e.Run();
+}
+
+// two seconds of each end's frames to the other, resends and ACKs included
+void Exchange(End& a, End& b)
+{
+    for (int i = 0; i < 100; ++i)
+    {
+        for (auto e : { &a, &b })
+        {
+            auto peer = e == &a ? &b : &a;
+            while (!e->A.Out.empty())
+            {
+                peer->A.Receive(e->A.Out.front());
+                e->A.Out.pop_front();
+            }
+        }
+        Host::AdvanceUS(20000);
+        a.Run();
+        b.Run();
+    }
+}
+
+// the sender gives up on a frame the receiver never got; the frames it holds past the gap are applied
+void AbandonedGap()
+{
+    End s, r;
+    for (long v = 1; v <= 4; ++v)
+        SendValue(s, v);
+    CHECK(s.A.Out.size() == 4);
+    s.A.Out.pop_front();
+    while (!s.A.Out.empty())
+    {
+        r.A.Receive(s.A.Out.front());
+        s.A.Out.pop_front();
+    }
+    r.Run();
+    CHECK(r.A.InputCount == 0);
+    // every resend of the first frame is lost too, and r's ACKs never arrive
+    while (s.A.FramesAbandoned == 0)
+    {
+        Host::AdvanceUS(50000);
+        s.Run();
+        s.A.Out.clear();
+    }
+    CHECK(s.A.FramesAbandoned == 4);
+    r.A.Out.clear();
+    // the next frame tells r not to wait for the lost one
+    SendValue(s, 5);
+    Exchange(s, r);
+    r.Run();
+    CHECK(r.A.FramesLost == 1);
+    CHECK(r.A.InputCount == 4);
+    CHECK(r.Value() == 5);
+}
+
+// an ACK made for the peer's previous session must not acknowledge frames of its new one
+void StaleAck()
+{
+    End a;
+    uint32_t applied;
+    Frame stale;
+    {
+        End b;
+        for (long v = 1; v <= 5; ++v)
+            SendValue(b, v);
+        Exchange(b, a);
+        CHECK(a.Value() == 5);
+        // a's frame carrying its ACK of b's five, delayed in the air
+        SendValue(a, 1);
+        CHECK(a.A.Out.size() == 1);
+        stale = a.A.Out.front();
+        Exchange(a, b);
+        applied = a.A.InputCount;
+    }
+    // b restarts and sends five frames, all lost; then the stale frame arrives
+    End b;
+    for (long v = 11; v <= 15; ++v)
+        SendValue(b, v);
+    b.A.Out.clear();
+    b.A.Receive(stale);
+    b.Run();
+    b.A.Out.clear();
+    // b still resends its five
+    Exchange(b, a);
+    CHECK(a.A.InputCount - applied == 5);
+    CHECK(a.Value() == 15);
+    CHECK(a.A.FramesLost == 0);
+}
+
+int main()
+{
+    Host::QuietSerial(true);
+    Host::SimulateClock();
+    Host::Seed(14);
+    AbandonedGap();
+    StaleAck();
+    return 0;
+}
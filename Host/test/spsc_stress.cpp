@@ -0,0 +1,115 @@
+// OMSliceRing and OMSpscQueue with the producer and consumer on separate threads,
+// as the ESP-NOW receive callback and the loop task use them
+// every item is checked for order and contents; build with -fsanitize=thread to check the orderings too
+#include "Host.h"
+#include "SliceRing.h"
+#include "SpscQueue.h"
+#include "Test.h"
+#include <chrono>
+#include <thread>
+
+const uint32_t Slices = 1000000;
+const uint32_t Items = 2000000;
+
+// slice contents follow from its sequence number, so the consumer can check them
+uint16_t SliceLen(uint32_t seq) { return 4 + (seq * 7919) % 97; }
+uint8_t SliceByte(uint32_t seq, uint16_t i) { return (uint8_t)(seq * 31 + i); }
+
+struct Item
+{
+    uint32_t    Seq;
+    uint32_t    Check[15];      // a torn read shows as a mismatch
+};
+
+double SecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void SliceRingStress()
+{
+    // small, so slices wrap the buffer end often
+    static OMSliceRing<512> ring;
+    auto start = std::chrono::steady_clock::now();
+    std::thread producer([] {
+        uint8_t buf[128];
+        for (uint32_t seq = 0; seq < Slices; ++seq)
+        {
+            uint16_t len = SliceLen(seq);
+            memcpy(buf, &seq, 4);
+            for (uint16_t i = 4; i < len; ++i)
+                buf[i] = SliceByte(seq, i);
+            // every other slice with its sequence number as a separate prefix, like the enqueue time
+            while (!(seq & 1 ? ring.Push(buf, 4, buf + 4, len - 4) : ring.Push(buf, len)))
+                std::this_thread::yield();
+        }
+    });
+    uint8_t buf[128];
+    for (uint32_t seq = 0; seq < Slices; )
+    {
+        uint16_t peek = ring.Peek();
+        if (peek == 0)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        uint16_t len = ring.Pop(buf, sizeof(buf));
+        CHECK(len == peek);
+        CHECK(len == SliceLen(seq));
+        uint32_t got;
+        memcpy(&got, buf, 4);
+        CHECK(got == seq);
+        for (uint16_t i = 4; i < len; ++i)
+            CHECK(buf[i] == SliceByte(seq, i));
+        ++seq;
+    }
+    producer.join();
+    CHECK(ring.Empty());
+    CHECK(ring.Pushed == Slices && ring.Popped == Slices && ring.Truncated == 0);
+    CHECK(ring.HighWater <= 512);
+    printf("OMSliceRing<512>: %u slices in %.2f s, %u pushes refused while full, high water %u\n",
+        Slices, SecondsSince(start), ring.Dropped, ring.HighWater);
+}
+
+void SpscQueueStress()
+{
+    static OMSpscQueue<Item, 8> queue;
+    auto start = std::chrono::steady_clock::now();
+    std::thread producer([] {
+        Item item;
+        for (uint32_t seq = 0; seq < Items; ++seq)
+        {
+            item.Seq = seq;
+            for (auto& c : item.Check)
+                c = seq ^ 0xA5A5A5A5;
+            while (!queue.Push(item))
+                std::this_thread::yield();
+        }
+    });
+    for (uint32_t seq = 0; seq < Items; )
+    {
+        auto item = queue.Front();
+        if (!item)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        CHECK(queue.Size() >= 1 && queue.Size() <= 8);
+        CHECK(item->Seq == seq);
+        for (auto c : item->Check)
+            CHECK(c == (seq ^ 0xA5A5A5A5));
+        queue.Pop();
+        ++seq;
+    }
+    producer.join();
+    CHECK(queue.Empty());
+    printf("OMSpscQueue<Item, 8>: %u items in %.2f s, %u pushes refused while full\n",
+        Items, SecondsSince(start), queue.Dropped);
+}
+
+int main()
+{
+    SliceRingStress();
+    SpscQueueStress();
+    return 0;
+}
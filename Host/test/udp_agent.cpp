@@ -0,0 +1,74 @@
+// two roots synchronizing over UdpAgent on localhost sockets
+#include "Host.h"
+#include "UdpAgent.h"
+#include "Test.h"
+#include <unistd.h>
+
+constexpr OMPropDef Props[] =
+{
+    { 'a', "A", OMT_LONG,   OMF_NONE, 0, 1000 },
+    { 's', "S", OMT_STRING, OMF_NONE },
+    { }
+};
+constexpr OMObjDef Objs[] =
+{
+    { 'x', "X", nullptr, Props, nullptr },
+    { 'y', "Y", nullptr, Props, nullptr },
+    { }
+};
+
+Root Dev(true, 'R', "Dev"), Ctl(false, 'R', "Ctl");
+UdpAgent DevAgent(nullptr, &Dev), CtlAgent(nullptr, &Ctl);
+
+template <typename Cond> bool RunUntil(Cond cond, uint32_t timeoutMS = 2000)
+{
+    uint32_t start = millis();
+    while (!cond())
+    {
+        if (millis() - start > timeoutMS)
+            return false;
+        DevAgent.Run();
+        CtlAgent.Run();
+        Dev.Run();
+        Ctl.Run();
+        usleep(200);
+    }
+    return true;
+}
+
+OMPropertyLong* Long(Root& root, char obj, char id) { return (OMPropertyLong*)root.GetObject(obj)->GetProperty(id); }
+OMPropertyString* Str(Root& root, char obj, char id) { return (OMPropertyString*)root.GetObject(obj)->GetProperty(id); }
+
+int main()
+{
+    Host::QuietSerial(true);
+    Dev.AddObjects(Objs);
+    Ctl.AddObjects(Objs);
+    Dev.BinaryWire = Ctl.BinaryWire = true;
+
+    uint16_t port = 20000 + getpid() % 20000;
+    // the controller listening before the device's first heartbeat
+    CtlAgent.Setup(IPAddress(127, 0, 0, 1), port, port + 1);
+    DevAgent.Setup(IPAddress(127, 0, 0, 1), port + 1, port);
+    Dev.Setup(&DevAgent);
+    Ctl.Setup(&CtlAgent);
+
+    // the controller negotiates binary on hearing the device
+    CHECK(RunUntil([] { return Dev.BinaryPeer && Ctl.BinaryPeer; }));
+
+    Long(Dev, 'x', 'a')->SetSend(123);
+    Str(Dev, 'y', 's')->SetSend("hello");
+    CHECK(RunUntil([] { return Long(Ctl, 'x', 'a')->Value == 123 && Str(Ctl, 'y', 's')->Value == "hello"; }));
+
+    Long(Ctl, 'y', 'a')->SetSend(456);
+    CHECK(RunUntil([] { return Long(Dev, 'y', 'a')->Value == 456; }));
+
+    // text commands as well as records
+    Ctl.SendCmd("=Rxa789");
+    CHECK(RunUntil([] { return Long(Dev, 'x', 'a')->Value == 789; }));
+
+    CHECK(DevAgent.FramesIn > 0 && CtlAgent.FramesIn > 0);
+    CHECK(DevAgent.Strays == 0 && CtlAgent.Strays == 0);
+    printf("frames in: device %u controller %u\n", DevAgent.FramesIn, CtlAgent.FramesIn);
+    return 0;
+}
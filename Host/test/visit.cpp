@@ -0,0 +1,134 @@
+// the Visit walkers over a 1,000 node tree, against the recursive traversal they replaced
+// each must visit the same nodes in the same order; the timings are printed for comparison
+#include "Host.h"
+#include "OMObject.h"
+#include "Test.h"
+#include <algorithm>
+#include <chrono>
+
+const int Groups = 10;      // objects under the root, each with GroupSize - 1 objects under it
+const int GroupSize = 10;
+const int PropCount = 9;    // on every object: 100 objects, 900 properties
+const int Rounds = 5;
+const int Passes = 2000;
+
+Root R(true, 'R', "R");
+
+// the traversal before the walkers: recursive, through a function pointer
+long Sum;
+void AddId(OMProperty* p) { Sum += p->Id; }
+void __attribute__((noinline)) Recurse(OMObject* o, void (*fn)(OMProperty*))
+{
+    for (auto p : o->Properties)
+        fn(p);
+    for (auto c : o->Objects)
+        Recurse(c, fn);
+}
+void RecurseNodes(OMObject* o, std::vector<OMNode*>& nodes)
+{
+    nodes.push_back(o);
+    for (auto p : o->Properties)
+        nodes.push_back(p);
+    for (auto c : o->Objects)
+        RecurseNodes(c, nodes);
+}
+
+// best of Rounds, ns per traversal
+template <typename Fn> double Time(Fn fn)
+{
+    double best = 1e18;
+    for (int round = 0; round < Rounds; ++round)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < Passes; ++i)
+            fn();
+        best = std::min(best, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / Passes);
+    }
+    return best;
+}
+
+void AddProperties(OMObject* o)
+{
+    for (int k = 0; k < PropCount; ++k)
+    {
+        auto p = new OMPropertyLong('A' + k, "p", 0, 10, k);
+        p->Flags = k == 3 ? OMF_LOCAL : OMF_NONE;
+        o->AddProperty(p);
+    }
+}
+
+int main()
+{
+    Host::QuietSerial(true);
+    for (int g = 0; g < Groups; ++g)
+    {
+        auto group = new OMObject('a' + g, "g", nullptr);
+        R.AddObject(group);
+        AddProperties(group);
+        for (int i = 1; i < GroupSize; ++i)
+        {
+            auto o = new OMObject('0' + i, "o", nullptr);
+            group->AddObject(o);
+            AddProperties(o);
+        }
+    }
+    std::vector<OMNode*> expect;
+    RecurseNodes(&R, expect);
+    CHECK(expect.size() == 1 + 1000);
+
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        // first with the walker, then with the handles Setup numbers
+        if (pass == 1)
+            R.Setup(nullptr);
+
+        std::vector<OMNode*> nodes;
+        R.VisitNodes([&](OMNode* n) { nodes.push_back(n); return true; });
+        CHECK(nodes == expect);
+        std::vector<OMNode*> props, objs;
+        R.VisitProperties([&](OMProperty* p) { props.push_back(p); return true; });
+        R.VisitObjects([&](OMObject* o) { objs.push_back(o); return true; });
+        std::vector<OMNode*> expectProps, expectObjs;
+        for (auto n : expect)
+            (n->IsObject() ? expectObjs : expectProps).push_back(n);
+        CHECK(props == expectProps && objs == expectObjs);
+        int locals = 0;
+        R.VisitProperties([&](OMProperty*) { ++locals; return true; }, OMFilter(-1, OMF_LOCAL));
+        CHECK(locals == Groups * GroupSize);
+        int seen = 0;
+        CHECK(!R.VisitNodes([&](OMNode*) { return ++seen < 50; }) && seen == 50);
+
+        // every timed traversal reads each node it is given
+        long recursed = 0, visited = 0, filtered = 0, nodeSum = 0;
+        double recurseNS = Time([&] { Sum = 0; Recurse(&R, AddId); recursed = Sum; });
+        double visitNS = Time([&] { visited = 0; R.VisitProperties([&](OMProperty* p) { visited += p->Id; return true; }); });
+        double filterNS = Time([&] {
+            filtered = 0;
+            R.VisitProperties([&](OMProperty* p) { filtered += p->Id; return true; }, OMFilter(OMT_LONG, OMF_LOCAL));
+        });
+        double nodesNS = Time([&] { nodeSum = 0; R.VisitNodes([&](OMNode* n) { nodeSum += n->Id; return true; }); });
+        CHECK(recursed == visited);
+        CHECK(filtered == ('A' + 3) * Groups * GroupSize);
+        long objectIds = 0;
+        for (auto n : expect)
+            objectIds += n->IsObject() ? n->Id : 0;
+        CHECK(nodeSum == visited + objectIds);
+        printf("%s: recursive %.0f ns, VisitProperties %.0f ns, filtered %.0f ns, VisitNodes %.0f ns per traversal\n",
+            pass ? "handles" : "walker ", recurseNS, visitNS, filterNS, nodesNS);
+    }
+
+    // a tree change drops the handles; the walker takes over with the new node in place
+    auto o = new OMObject('Z', "z", nullptr);
+    o->AddProperty(new OMPropertyLong('x', "x", 0, 1, 0));
+    R.AddObject(o);
+    std::vector<OMNode*> props, expectProps, all;
+    RecurseNodes(&R, all);
+    for (auto n : all)
+    {
+        if (!n->IsObject())
+            expectProps.push_back(n);
+    }
+    R.VisitProperties([&](OMProperty* p) { props.push_back(p); return true; });
+    CHECK(props == expectProps);
+    return 0;
+}
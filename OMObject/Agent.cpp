@@ -3,41 +3,432 @@
 
 void Agent::Run()
 {
-    if (!inputCommands.empty())
+    if (inputCommands.Dropped != ReportedDrops)
     {
-        // process an input command
-        // NOTE: Disabling interrupts during the critical section removing
-        // an input command from the queue
-        // We just do one cmd at a time here to let the receive interrupt do its thing
-        noInterrupts();
-        auto cmd = inputCommands.front();
-        inputCommands.pop();
-        interrupts();
-        flogv("Input command: [%s]", cmd.c_str());
-        pRoot->Command(cmd);
-        // prioritize input commands over output commands
-        // doing another in the next iteration of the Loop()
+        flogw("input commands dropped: %lu  ring high water: %lu", inputCommands.Dropped - ReportedDrops, inputCommands.HighWater);
+        ReportedDrops = inputCommands.Dropped;
+    }
+    auto outputDrops = outputCommands.Dropped + outputRecords.Dropped;
+    if (outputDrops != ReportedOutputDrops)
+    {
+        flogw("output commands dropped: %lu", outputDrops - ReportedOutputDrops);
+        ReportedOutputDrops = outputDrops;
+    }
+
+    // process input commands until the queue is empty or the budget is spent
+    uint8_t cmd[4 + 252];
+    uint16_t cmdLen;
+    uint16_t count = 0;
+    uint32_t start = micros();
+    while (count < InputBudgetCount && (cmdLen = inputCommands.Pop(cmd, sizeof(cmd))) > 0)
+    {
+        uint32_t queued;
+        memcpy(&queued, cmd, sizeof(queued));
+        uint32_t applyStart = micros();
+        ApplyInput(cmd + sizeof(queued), cmdLen - sizeof(queued));
+        ++count;
+        uint32_t now = micros();
+        uint32_t apply = now - applyStart;
+        uint8_t bucket = apply == 0 ? 0 : 32 - __builtin_clz(apply);
+        ++ApplyHist[bucket < ApplyBuckets ? bucket : ApplyBuckets - 1];
+        uint32_t latency = now - queued;
+        InputLatencyAvgUS = InputLatencyAvgUS == 0 ? latency : (InputLatencyAvgUS * 7 + latency) / 8;
+        if (latency > InputLatencyMaxUS)
+            InputLatencyMaxUS = latency;
+        if (now - start >= InputBudgetUS)
+            break;
+    }
+    InputCount += count;
+    // settled sends, change notifications and autosave, right after the input that set them off
+    pRoot->Service();
+    if (millis() - RateMS >= 1000)
+    {
+        InputRate = InputCount - RateCount;
+        RateCount = InputCount;
+        RateMS = millis();
+    }
+    // prioritize input commands over output commands
+    // finishing the backlog in the next iteration of the Loop()
+    if (!inputCommands.Empty())
         return;
+
+    ServiceSequencing();
+    // values went missing in dropped frames: the generation marks no longer say what the peer has
+    if (FramesAbandoned != ReportedAbandoned || FramesLost != ReportedLost)
+    {
+        pRoot->FramesDropped(FramesLost != ReportedLost);
+        ReportedAbandoned = FramesAbandoned;
+        ReportedLost = FramesLost;
     }
+    // too many frames unacknowledged: let output wait in the queues
+    if (SeqWindowFull())
+        return;
+
+    // pull coalesced property updates into the (otherwise drained) output queues
+    // a frame's worth at a time, so each carries the latest values
+    if (outputCommands.Empty() && outputRecords.Empty())
+        pRoot->FlushProperties(MaxFrame);
 
-    if (!outputCommands.empty())
+    if (!outputCommands.Empty())
     {
         // process output commands to peer
         uint8_t data[250];
         uint8_t len = 0;
-        while (!outputCommands.empty())
+        while (!outputCommands.Empty())
         {
-            auto cmd = outputCommands.front();
-            auto cmdLen = cmd.length();
-            if (len + cmdLen + 1 > sizeof(data))
+            auto cmdLen = outputCommands.Peek();
+            if (len + cmdLen + 1 > MaxFrame)
+            {
+                if (len == 0)
+                {
+                    // can never fit in a frame
+                    floge("command too long: %u", cmdLen);
+                    outputCommands.Pop(data, 0);
+                    continue;
+                }
                 break;
-            outputCommands.pop();
+            }
             if (len > 0)
                 data[len++] = ';';
-            strcpy((char*)&data[len], cmd.c_str());
-            len += cmdLen;
+            len += outputCommands.Pop(&data[len], MaxFrame - len);
+            ++OutputCommands;
         }
         // flogv("Send commands: [%s]", data);
-        Send(data, len);
+        if (len > 0)
+            SendFrame(data, len);
+        return;
     }
+
+    if (!outputRecords.Empty())
+    {
+        // pack binary records into a frame tagged so the peer won't parse it as text
+        uint8_t data[250];
+        uint8_t len = 0;
+        data[len++] = OMB_FRAME;
+        while (auto recLen = outputRecords.Peek())
+        {
+            if (len + recLen + 1 > MaxFrame)
+                break;
+            data[len++] = recLen;
+            len += outputRecords.Pop(&data[len], MaxFrame - len);
+            ++OutputCommands;
+        }
+        SendFrame(data, len);
+    }
+}
+
+uint32_t Agent::ApplyPercentileUS(uint8_t percent)
+{
+    uint32_t total = 0;
+    for (auto n : ApplyHist)
+        total += n;
+    if (total == 0)
+        return 0;
+    // first bucket reaching the percentile; its upper bound
+    uint32_t target = (uint64_t)total * percent / 100;
+    uint32_t sum = 0;
+    for (uint8_t i = 0; i < ApplyBuckets; ++i)
+    {
+        sum += ApplyHist[i];
+        if (sum >= target && sum > 0)
+            return 1u << i;
+    }
+    return 1u << (ApplyBuckets - 1);
+}
+
+void Agent::ApplyInput(const uint8_t *cmd, int len)
+{
+    if (len <= 0)
+        return;
+    if (cmd[0] == OMB_FRAME)
+    {
+        OMRecord rec;
+        rec.Len = len - 1;
+        memcpy(rec.Data, cmd + 1, rec.Len);
+        pRoot->Command(rec);
+    }
+    else
+    {
+        String s(cmd, len);
+        flogv("Input command: [%s]", s.c_str());
+        pRoot->Command(s);
+    }
+}
+
+void Agent::QueueInput(const uint8_t* tag, uint16_t tagLen, const uint8_t *pData, int len)
+{
+    // stamp the enqueue time ahead of the optional tag
+    uint8_t prefix[4 + 1];
+    uint32_t now = micros();
+    memcpy(prefix, &now, sizeof(now));
+    if (tagLen > 0)
+        memcpy(prefix + sizeof(now), tag, tagLen);
+    inputCommands.Push(prefix, sizeof(now) + tagLen, pData, len);
+}
+
+void Agent::ReceiveCommands(const uint8_t *pData, int len)
+{
+    // queue each ';' separated command straight from the received frame
+    while (len > 0)
+    {
+        auto end = (const uint8_t*)memchr(pData, ';', len);
+        int cmdLen = end ? end - pData : len;
+        if (cmdLen > 0)
+            QueueInput(nullptr, 0, pData, cmdLen);
+        pData += cmdLen + 1;
+        len -= cmdLen + 1;
+    }
+}
+
+void Agent::ReceiveRecords(const uint8_t *pData, int len)
+{
+    // split a binary frame (following the OMB_FRAME tag) into records
+    int inx = 0;
+    while (inx < len)
+    {
+        uint8_t recLen = pData[inx++];
+        if (recLen > OMRecordMax || inx + recLen > len)
+        {
+            floge("malformed binary frame");
+            return;
+        }
+        QueueInput(&OMB_FRAME, 1, pData + inx, recLen);
+        inx += recLen;
+    }
+}
+
+void Agent::EnableSequencing()
+{
+    Sequenced = true;
+    // only transports that sequence carry the window's frames
+    if (!TxSeqSlots)
+    {
+        TxSeqSlots = new SeqSlot[SeqWindow];
+        RxSeqSlots = new SeqSlot[SeqWindow];
+    }
+    TxEpoch = esp_random();
+    MaxFrame = sizeof(SeqSlot::Data) - sizeof(SeqHdr);
+}
+
+void Agent::SendFrame(const uint8_t *pData, int len)
+{
+    ++OutputFrames;
+    OutputBytes += len;
+    if (!Sequenced)
+    {
+        Send(pData, len);
+        return;
+    }
+    auto& slot = TxSeqSlots[TxSeqNext % SeqWindow];
+    slot.Len = len;
+    memcpy(slot.Data, pData, len);
+    if (TxSeqNext == TxSeqBase)
+        TxSeqProgressMS = millis();
+    TxSeqSentUS[TxSeqNext % SeqWindow] = micros();
+    TxSeqResent[TxSeqNext % SeqWindow] = false;
+    ++FramesSent;
+    ResendFrame(TxSeqNext++);
+}
+
+void Agent::ResendFrame(uint16_t seq)
+{
+    // (re)built with current ack and first so a resend carries fresh state
+    auto& slot = TxSeqSlots[seq % SeqWindow];
+    SeqHdr hdr = { OMS_FRAME, TxEpoch, seq, RxSeqNext, RxEpoch, TxSeqBase };
+    uint8_t frame[sizeof(hdr) + sizeof(slot.Data)];
+    memcpy(frame, &hdr, sizeof(hdr));
+    memcpy(frame + sizeof(hdr), slot.Data, slot.Len);
+    Send(frame, sizeof(hdr) + slot.Len);
+    // this frame carries the ACK
+    AckDue = false;
+    AckDueMS = 0;
+}
+
+void Agent::ServiceSequencing()
+{
+    if (!Sequenced)
+        return;
+
+    while (auto ack = PeerAcks.Front())
+    {
+        // ignore ACKs from an earlier session or outside what we have sent
+        if (ack->epoch == TxEpoch && (int16_t)(ack->ack - TxSeqBase) >= 0 && (int16_t)(TxSeqNext - ack->ack) >= 0)
+        {
+            if (ack->ack != TxSeqBase)
+            {
+                // time the newest frame acknowledged, unless it was resent and the ACK may be for either send
+                uint16_t acked = ack->ack - 1;
+                if (!TxSeqResent[acked % SeqWindow])
+                {
+                    uint32_t rtt = micros() - TxSeqSentUS[acked % SeqWindow];
+                    LinkRttUS = LinkRttUS == 0 ? rtt : (LinkRttUS * 7 + rtt) / 8;
+                }
+                TxSeqBase = ack->ack;
+                TxSeqProgressMS = millis();
+                TxSeqRetries = 0;
+            }
+            if (ack->bits != 0 && TxSeqResentBase != TxSeqBase)
+            {
+                // the peer holds frames past a gap: resend just the missing ones, once per gap
+                TxSeqResentBase = TxSeqBase;
+                uint16_t last = TxSeqBase;
+                for (uint8_t i = 0; i < 32; ++i)
+                {
+                    if (ack->bits & (1u << i))
+                        last = TxSeqBase + 1 + i;
+                }
+                for (uint16_t seq = TxSeqBase; seq != last; ++seq)
+                {
+                    if (seq != TxSeqBase && (ack->bits & (1u << (uint16_t)(seq - TxSeqBase - 1))))
+                        continue;
+                    ++FramesResent;
+                    TxSeqResent[seq % SeqWindow] = true;
+                    ResendFrame(seq);
+                }
+            }
+        }
+        PeerAcks.Pop();
+    }
+
+    if (TxSeqBase != TxSeqNext && millis() - TxSeqProgressMS > SeqResendMS)
+    {
+        if (++TxSeqRetries > SeqMaxRetries)
+        {
+            // the peer is gone; frames from here on tell it (via first) not to wait for these
+            flogw("abandoning %u unacknowledged frames", (uint16_t)(TxSeqNext - TxSeqBase));
+            FramesAbandoned += (uint16_t)(TxSeqNext - TxSeqBase);
+            TxSeqBase = TxSeqNext;
+            TxSeqRetries = 0;
+        }
+        else
+        {
+            ++FramesResent;
+            TxSeqResent[TxSeqBase % SeqWindow] = true;
+            ResendFrame(TxSeqBase);
+            TxSeqResentBase = 0xFFFF;
+        }
+        TxSeqProgressMS = millis();
+    }
+
+    // ACK on its own when no frame of ours has carried it in time
+    if (AckNow || AckDue)
+    {
+        uint32_t now = millis();
+        if (AckDueMS == 0)
+            AckDueMS = now;
+        if (AckNow || now - AckDueMS >= SeqAckDelayMS)
+        {
+            AckHdr hdr = { OMA_FRAME, RxEpoch, RxSeqNext, RxSeqHeld >> 1 };
+            Send((uint8_t*)&hdr, sizeof(hdr));
+            AckNow = false;
+            AckDue = false;
+            AckDueMS = 0;
+        }
+    }
+}
+
+void Agent::DeliverFrame(const uint8_t *pData, int len)
+{
+    if (len <= 0)
+        return;
+    if (pData[0] == OMB_FRAME)
+        ReceiveRecords(pData + 1, len - 1);
+    else
+        ReceiveCommands(pData, len);
+}
+
+uint16_t Agent::AdvanceRx(uint16_t to)
+{
+    // deliver the frames held on the way to, and those then in order
+    uint16_t next = RxSeqNext;
+    uint32_t held = RxSeqHeld;
+    uint16_t missing = 0;
+    while (next != to)
+    {
+        if (held & 1)
+        {
+            auto& slot = RxSeqSlots[next % SeqWindow];
+            DeliverFrame(slot.Data, slot.Len);
+        }
+        else
+            ++missing;
+        ++next;
+        held >>= 1;
+    }
+    while (held & 1)
+    {
+        auto& slot = RxSeqSlots[next % SeqWindow];
+        DeliverFrame(slot.Data, slot.Len);
+        ++next;
+        held >>= 1;
+    }
+    RxSeqHeld = held;
+    RxSeqNext = next;
+    return missing;
+}
+
+void Agent::ReceiveSequenced(const uint8_t *pData, int len)
+{
+    SeqHdr hdr;
+    if (len < (int)sizeof(hdr) || !RxSeqSlots)
+        return;
+    memcpy(&hdr, pData, sizeof(hdr));
+    pData += sizeof(hdr);
+    len -= sizeof(hdr);
+
+    // the piggybacked ACK of our own frames, in the session it was made for
+    AckHdr ack = { OMA_FRAME, hdr.ackEpoch, hdr.ack, 0 };
+    PeerAcks.Push(ack);
+
+    // the sender's oldest frame can't be further behind what we have taken than its window,
+    // unless it restarted and drew the epoch of its previous session
+    if (!RxStarted || hdr.epoch != RxEpoch || (int16_t)(RxSeqNext - hdr.first) > SeqWindow)
+    {
+        // first frame from this peer session
+        RxStarted = true;
+        RxEpoch = hdr.epoch;
+        RxSeqNext = hdr.first;
+        RxSeqHeld = 0;
+    }
+    if ((int16_t)(hdr.first - RxSeqNext) > 0)
+    {
+        // the sender gave up on frames; those we hold are still delivered
+        FramesLost += AdvanceRx(hdr.first);
+    }
+
+    int16_t offset = hdr.seq - RxSeqNext;
+    if (offset < 0)
+    {
+        // resent after our ACK was lost
+        ++FramesDuplicate;
+        AckNow = true;
+        return;
+    }
+    if (offset >= SeqWindow || len > (int)sizeof(SeqSlot::Data))
+    {
+        floge("frame %u outside window at %u", hdr.seq, (uint16_t)RxSeqNext);
+        return;
+    }
+    if (offset > 0)
+    {
+        // early: hold it until the gap is filled and tell the sender what is missing
+        auto& slot = RxSeqSlots[hdr.seq % SeqWindow];
+        slot.Len = len;
+        memcpy(slot.Data, pData, len);
+        RxSeqHeld = RxSeqHeld | (1u << offset);
+        AckNow = true;
+        return;
+    }
+    DeliverFrame(pData, len);
+    AdvanceRx(hdr.seq + 1);
+    AckDue = true;
+}
+
+void Agent::ReceiveAck(const uint8_t *pData, int len)
+{
+    AckHdr ack;
+    if (len < (int)sizeof(ack))
+        return;
+    memcpy(&ack, pData, sizeof(ack));
+    PeerAcks.Push(ack);
 }
@@ -1,9 +1,17 @@
 #pragma once
 
 #include <Arduino.h>
-#include <queue>
 #include "FS.h"
 #include "OMObject.h"
+#include "SliceRing.h"
+#include "SpscQueue.h"
+
+// sequenced command frame: SeqHdr followed by a text or OMB_FRAME frame
+// the receiver applies them in order, holding early frames, and ACKs cumulatively
+// the sender keeps unacknowledged frames and resends only those the ACKs show missing
+const uint8_t OMS_FRAME = 0x03;
+// standalone ACK: AckHdr
+const uint8_t OMA_FRAME = 0x04;
 
 class Agent
 {
@@ -12,10 +20,126 @@ public:
     virtual void    Run();
     virtual bool    Send(const uint8_t *pData, int len) = 0;
     virtual void    StartFileTransfer(String filePath) = 0;
-    void            SendCmd(String cmd) { outputCommands.push(cmd); }
+    // queue output for the peer; call only from the loop task (the queues' single producer)
+    void            SendCmd(String cmd) { outputCommands.Push((const uint8_t*)cmd.c_str(), cmd.length()); }
+    void            SendCmd(const uint8_t* cmd, uint16_t len) { outputCommands.Push(cmd, len); }
+    void            SendRecord(const OMRecord& rec) { outputRecords.Push(rec.Data, rec.Len); }
+
+    uint8_t         MaxFrame = 250;     // output frame size; less if the transport adds a header
+
+    // input commands applied per Run: until the queue is empty or either budget is spent
+    uint16_t        InputBudgetCount = 32;
+    uint32_t        InputBudgetUS = 2000;
+    // input statistics
+    uint32_t        InputDepth() { return inputCommands.Count(); }
+    uint32_t        InputLatencyAvgUS = 0;  // enqueue to apply, moving average
+    uint32_t        InputLatencyMaxUS = 0;  // enqueue to apply, worst since reset
+    // command path cost: time to apply each input command, in power of two buckets
+    // bucket i counts commands taking under 2^i microseconds (and at least 2^(i-1))
+    static const uint8_t ApplyBuckets = 20;
+    uint32_t        ApplyHist[ApplyBuckets] = {};
+    uint32_t        ApplyPercentileUS(uint8_t percent);     // bucket bound; 0 if nothing applied
+    void            ResetApplyHist() { memset(ApplyHist, 0, sizeof(ApplyHist)); }
+    uint32_t        InputCount = 0;         // commands applied
+    uint32_t        InputRate = 0;          // commands applied per second, over the last second
+    // output packing
+    uint32_t        OutputFrames = 0;
+    uint32_t        OutputBytes = 0;
+    uint32_t        OutputCommands = 0;     // commands and records packed into those frames
+
+    // command channel statistics
+    uint32_t        FramesSent = 0;
+    uint32_t        FramesResent = 0;
+    uint32_t        FramesAbandoned = 0;    // given up on by us
+    uint32_t        FramesLost = 0;         // given up on by the peer
+    uint32_t        FramesDuplicate = 0;
+
+    // link quality, kept up by the transport
+    uint32_t        LinkRttUS = 0;          // frame to ACK, moving average; includes the peer's ACK delay
+    uint16_t        LinkLossPM = 0;         // failed sends per thousand, moving average
+    int8_t          LinkRssi = 0;           // dBm of the last frame from the peer; 0 if unknown or not tracked
+    uint32_t        HeartbeatMS = 0;        // current heartbeat period; 0 if the transport has none
 protected:
     FS*     pFS;
-    std::queue<String> inputCommands;
-    std::queue<String> outputCommands;
+    // input commands and binary records (tagged OMB_FRAME) as received from the peer
+    // each preceded by its 4 byte micros() enqueue time
+    OMSliceRing<2048> inputCommands;
+    // output: Root::FlushProperties adds a frame's worth of values only once both are drained,
+    // so they hold little more than that and the odd control command
+    OMSliceRing<1024> outputCommands;
+    OMSliceRing<512> outputRecords;
+    uint32_t        ReportedDrops = 0;
+    uint32_t        ReportedOutputDrops = 0;
+    uint32_t        ReportedAbandoned = 0;
+    uint32_t        ReportedLost = 0;
+    uint32_t        RateCount = 0;
+    uint32_t        RateMS = 0;
+    void            ReceiveCommands(const uint8_t *pData, int len);
+    void            ReceiveRecords(const uint8_t *pData, int len);
+    void            QueueInput(const uint8_t* tag, uint16_t tagLen, const uint8_t *pData, int len);
+    void            ApplyInput(const uint8_t *cmd, int len);
     Root* pRoot;
+
+    // sequencing of command frames; the transport enables it and routes
+    // OMS_FRAME and OMA_FRAME to ReceiveSequenced and ReceiveAck
+    void            EnableSequencing();
+    void            ReceiveSequenced(const uint8_t *pData, int len);
+    void            ReceiveAck(const uint8_t *pData, int len);
+private:
+    struct SeqHdr
+    {
+        uint8_t     tag;
+        uint16_t    epoch;      // sender's session; a new one resets the receiver
+        uint16_t    seq;
+        uint16_t    ack;        // next seq expected from the peer
+        uint16_t    ackEpoch;   // peer's session that ack is for
+        uint16_t    first;      // oldest seq the sender can still resend
+    };
+    struct AckHdr
+    {
+        uint8_t     tag;
+        uint16_t    epoch;      // session of the stream being acknowledged
+        uint16_t    ack;
+        uint32_t    bits;       // bit i: seq ack + 1 + i held
+    };
+    static const uint8_t SeqWindow = 8;             // unacknowledged frames; at most 32 for the ACK bitmap
+    static const uint32_t SeqResendMS = 200;        // resend when ACKs stop making progress
+    static const uint8_t SeqMaxRetries = 10;        // then abandon the unacknowledged frames
+    static const uint32_t SeqAckDelayMS = 20;       // wait for a frame to carry the ACK before sending it alone
+    struct SeqSlot
+    {
+        uint8_t     Len;
+        uint8_t     Data[250];
+    };
+    bool            Sequenced = false;
+
+    // sender (loop task)
+    uint16_t        TxEpoch = 0;
+    uint16_t        TxSeqNext = 0;
+    uint16_t        TxSeqBase = 0;          // oldest unacknowledged
+    uint16_t        TxSeqResentBase = 0xFFFF;
+    uint32_t        TxSeqProgressMS = 0;
+    uint8_t         TxSeqRetries = 0;
+    SeqSlot*        TxSeqSlots = nullptr;   // SeqWindow of them, allocated by EnableSequencing
+    uint32_t        TxSeqSentUS[SeqWindow];    // first send, for the round trip time
+    bool            TxSeqResent[SeqWindow];    // no round trip sample from a resent frame's ACK
+    uint32_t        AckDueMS = 0;
+    void            SendFrame(const uint8_t *pData, int len);
+    void            ResendFrame(uint16_t seq);
+    void            ServiceSequencing();
+    bool            SeqWindowFull() { return Sequenced && (uint16_t)(TxSeqNext - TxSeqBase) >= SeqWindow; }
+
+    // receiver (receive callback); ACK state is read by the loop task
+    bool            RxStarted = false;
+    uint16_t        RxEpoch = 0;
+    std::atomic<uint16_t> RxSeqNext { 0 };
+    std::atomic<uint32_t> RxSeqHeld { 0 };  // bit i: seq RxSeqNext + i held in RxSeqSlots
+    SeqSlot*        RxSeqSlots = nullptr;
+    std::atomic<bool> AckDue { false };
+    std::atomic<bool> AckNow { false };     // gap or duplicate: ACK without delay
+    void            DeliverFrame(const uint8_t *pData, int len);
+    uint16_t        AdvanceRx(uint16_t to);    // returns the frames passed over that were never held
+
+    // peer's ACKs of our frames (receive callback to loop task)
+    OMSpscQueue<AckHdr, 8> PeerAcks;
 };
@@ -1,5 +1,6 @@
 #include "Debug.h"
 #include "Agent.h"
+#include "OMPrefs.h"
 
 DebugConnector DebugConn;
 Debug Debug::debug;
@@ -21,6 +22,26 @@ void DebugConnector::Push(OMObject* obj, OMProperty* prop)
         FLogger::setLogLevel((flog_level)((OMPropertyChar*)prop)->Index());
         break;
     }
+    auto agent = ((Root*)obj->MyRoot())->GetAgent();
+    if (!agent)
+        return;
+    switch (id)
+    {
+    case 'c':   // InBudget
+        agent->InputBudgetCount = prop->As<long>()->Value;
+        break;
+    case 'u':   // InBudgetUS
+        agent->InputBudgetUS = prop->As<long>()->Value;
+        break;
+    case 'm':   // InLatMax
+        // writing resets the worst case
+        agent->InputLatencyMaxUS = prop->As<long>()->Value;
+        break;
+    case 'y':   // ApplyP99
+        // writing starts a new measurement
+        agent->ResetApplyHist();
+        break;
+    }
 }
 
 void DebugConnector::Pull(OMObject *obj, OMProperty *prop)
@@ -32,6 +53,60 @@ void DebugConnector::Pull(OMObject *obj, OMProperty *prop)
     case 'l':   // LogLevel
         ((OMPropertyChar*)prop)->Value = ((OMPropertyChar*)prop)->FromIndex(FLogger::getLogLevel());
         break;
+    case 'w':   // PrefWrites
+        prop->As<long>()->Value = OMPrefs::Writes;
+        break;
+    case 'z':   // PrefSkips
+        prop->As<long>()->Value = OMPrefs::Unchanged;
+        break;
+    case 'v':   // AutoSaves
+        prop->As<long>()->Value = ((Root*)obj->MyRoot())->AutoSaves;
+        break;
+    }
+    auto agent = ((Root*)obj->MyRoot())->GetAgent();
+    if (!agent)
+        return;
+    switch (id)
+    {
+    case 'c':   // InBudget
+        prop->As<long>()->Value = agent->InputBudgetCount;
+        break;
+    case 'u':   // InBudgetUS
+        prop->As<long>()->Value = agent->InputBudgetUS;
+        break;
+    case 'q':   // InDepth
+        prop->As<long>()->Value = agent->InputDepth();
+        break;
+    case 'a':   // InLatAvg
+        prop->As<long>()->Value = agent->InputLatencyAvgUS;
+        break;
+    case 'm':   // InLatMax
+        prop->As<long>()->Value = agent->InputLatencyMaxUS;
+        break;
+    case 't':   // RttUS
+        prop->As<long>()->Value = agent->LinkRttUS;
+        break;
+    case 'o':   // LossPM
+        prop->As<long>()->Value = agent->LinkLossPM;
+        break;
+    case 'r':   // RSSI
+        prop->As<long>()->Value = agent->LinkRssi;
+        break;
+    case 'h':   // HeartMS
+        prop->As<long>()->Value = agent->HeartbeatMS;
+        break;
+    case 'k':   // CmdRate
+        prop->As<long>()->Value = agent->InputRate;
+        break;
+    case 'b':   // FrameBytes
+        prop->As<long>()->Value = agent->OutputFrames ? agent->OutputBytes / agent->OutputFrames : 0;
+        break;
+    case 'p':   // ApplyP50
+        prop->As<long>()->Value = agent->ApplyPercentileUS(50);
+        break;
+    case 'y':   // ApplyP99
+        prop->As<long>()->Value = agent->ApplyPercentileUS(99);
+        break;
     }
 }
 
@@ -44,6 +119,13 @@ void Debug::Run()
 {
 	if (Metro)
 	{
+        // refresh the statistics properties
+        if (DebugObject)
+        {
+            for (auto p : DebugObject->Properties)
+                p->Pull();
+        }
+
 		if (Serial.available())
 		{
             static String cmd;
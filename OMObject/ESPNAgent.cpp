@@ -1,95 +1,275 @@
 #include "ESPNAgent.h"
 #include "FLogger.h"
+#include <new>
 
 void DumpMac(const char* msg, const uint8_t* mac)
 {
     flogv("%s: %02X:%02X:%02X:%02X:%02X:%02X", msg, mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
 }
 
+uint32_t FileCrc32(uint32_t crc, const uint8_t* pData, size_t len)
+{
+    // CRC-32 (IEEE), a nibble at a time
+    static const uint32_t table[16] =
+    {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+    };
+    crc = ~crc;
+    while (len--)
+    {
+        crc ^= *pData++;
+        crc = (crc >> 4) ^ table[crc & 0x0F];
+        crc = (crc >> 4) ^ table[crc & 0x0F];
+    }
+    return ~crc;
+}
+
 std::vector<ESPNAgent*> ESPNAgent::ESPNAgents;
+ESPNAgent* ESPNAgent::PeerTable[ESPNAgent::PeerTableSize];
+size_t ESPNAgent::RunStart = 0;
+std::atomic<uint8_t> ESPNAgent::InFlightAll { 0 };
+
+uint8_t ESPNAgent::PeerHash(const uint8_t* mac)
+{
+    // the vendor prefix is often shared, so hash the device specific half
+    return (mac[3] * 31u * 31u + mac[4] * 31u + mac[5]) & (PeerTableSize - 1);
+}
 
-ESPNAgent* ESPNAgent::FindAgent(const uint8_t* peerMacAddress)
+ESPNAgent* ESPNAgent::FindAgent(const uint8_t* peerMacAddress, bool quiet)
 {
-    for (auto agent : ESPNAgents)
+    // called from the ESP-NOW callbacks for every frame, so a direct hash probe
+    // rather than a scan of all agents
+    auto h = PeerHash(peerMacAddress);
+    while (auto agent = PeerTable[h])
     {
         if (memcmp(agent->PeerInfo.peer_addr, peerMacAddress, 6) == 0)
             return agent;
+        h = (h + 1) & (PeerTableSize - 1);
     }
-    DumpMac("Agent not found", peerMacAddress);
-    flogf("");
+    if (!quiet)
+        DumpMac("Agent not found", peerMacAddress);
     return nullptr;
 }
 
+void ESPNAgent::OnPromiscuousRecv(void* buf, wifi_promiscuous_pkt_type_t type)
+{
+    // ESP-NOW frames are 802.11 action frames; the sender is the header's second address
+    // called for every management frame heard, so only a quiet hash probe per frame
+    if (type != WIFI_PKT_MGMT)
+        return;
+    auto pkt = (const wifi_promiscuous_pkt_t*)buf;
+    if (pkt->payload[0] != 0xD0)
+        return;
+    auto agent = FindAgent(pkt->payload + 10, true);
+    if (agent)
+        agent->LinkRssi = pkt->rx_ctrl.rssi;
+}
+
+void ESPNAgent::TrackRssi(bool enable)
+{
+    // overhear management frames for the RSSI of each peer's frames
+    if (enable)
+    {
+        wifi_promiscuous_filter_t filter = { WIFI_PROMIS_FILTER_MASK_MGMT };
+        esp_wifi_set_promiscuous_filter(&filter);
+        esp_wifi_set_promiscuous_rx_cb(OnPromiscuousRecv);
+    }
+    if (esp_wifi_set_promiscuous(enable) != ESP_OK)
+    {
+        flogw("RSSI tracking unavailable");
+        return;
+    }
+    if (!enable)
+    {
+        for (auto agent : ESPNAgents)
+            agent->LinkRssi = 0;
+    }
+}
+
 void DataSentCb(const uint8_t *mac_addr, esp_now_send_status_t status)
 {
-    ESPNAgent::FindAgent(mac_addr)->OnDataSent(status);
+    auto agent = ESPNAgent::FindAgent(mac_addr);
+    if (agent)
+        agent->OnDataSent(status);
 }
 
 void DataRecvCb(const uint8_t *mac_addr, const uint8_t *pData, int len)
 {
-    ESPNAgent::FindAgent(mac_addr)->OnDataRecv(pData, len);
+    auto agent = ESPNAgent::FindAgent(mac_addr);
+    if (agent)
+        agent->OnDataRecv(pData, len);
 }
 
 void ESPNAgent::Setup(uint8_t peerMacAddress[])
 {
     memset(&PeerInfo, 0, sizeof(PeerInfo));
     memcpy(PeerInfo.peer_addr, peerMacAddress, sizeof(PeerInfo.peer_addr));
+    if (ESPNAgents.size() >= PeerTableSize / 2)
+        flogf("too many ESPNAgents");
     ESPNAgents.push_back(this);
+    auto h = PeerHash(peerMacAddress);
+    while (PeerTable[h])
+        h = (h + 1) & (PeerTableSize - 1);
+    PeerTable[h] = this;
     DumpMac("Register Agent", peerMacAddress);
 
-    // flogi("WIFI init");
-    if (!WiFi.mode(WIFI_STA))
-        flogf("WIFI init FAILED");
+    if (ESPNAgents.size() == 1)
+    {
+        // radio and ESP-NOW are shared by all agents; set them up once
+        // flogi("WIFI init");
+        if (!WiFi.mode(WIFI_STA))
+            flogf("WIFI init FAILED");
+
+        flogi("MAC addr: %s", WiFi.macAddress().c_str());
 
-    flogi("MAC addr: %s", WiFi.macAddress().c_str());
+        // flogi("ESP_NOW init");
+        if (esp_now_init() != ESP_OK)
+            flogf("ESP_NOW init FAILED");
 
-    // flogi("ESP_NOW init");
-    if (esp_now_init() != ESP_OK)
-        flogf("ESP_NOW init FAILED");
+        esp_now_register_send_cb(DataSentCb);
+        esp_now_register_recv_cb(DataRecvCb);
+
+        // flogi("ESP_NOW init complete");
+    }
 
     if (esp_now_add_peer(&PeerInfo) != ESP_OK)
         flogf("ESP_NOW peer add FAILED");
 
-    esp_now_register_send_cb(DataSentCb);
-    esp_now_register_recv_cb(DataRecvCb);
-
-    // flogi("ESP_NOW init complete");
+    if (GroupId >= 0)
+        return;     // no heartbeats, connection tracking or ACKs for a broadcast
+    EnableSequencing();
 
+    HeartbeatMS = HeartbeatMaxMS;
     if (pRoot->IsDevice)
     {
-        SendCmd(".");   // send heartbeat to let controller know we're alive
+        Metro.PeriodMS = HeartbeatMS;
+        SendHeartbeat();    // let controller know we're alive
     }
     else
+        AdaptTimeout();
+}
+
+void ESPNAgent::SendHeartbeat()
+{
+    // sent raw: a lost heartbeat needs no resend and mustn't hold up sequenced frames
+    Heartbeat hb = { '.', (uint16_t)HeartbeatMS };
+    Send((uint8_t*)&hb, sizeof(hb));
+}
+
+void ESPNAgent::AdaptTimeout()
+{
+    // controller: a longer timeout than the device's heartbeat so we're not racing it,
+    // by a margin that grows with the round trip time
+    uint32_t period = PeerHeartbeatMS != 0 ? PeerHeartbeatMS.load() : HeartbeatMaxMS;
+    uint32_t margin = LinkRttUS * 4 / 1000;
+    if (margin < TimeoutMarginMS)
+        margin = TimeoutMarginMS;
+    HeartbeatMS = period;
+    Metro.PeriodMS = period + margin;
+}
+
+void ESPNAgent::SetupGroup(uint8_t groupId)
+{
+    GroupId = groupId & 31;
+    MaxFrame = ESP_NOW_MAX_DATA_LEN - sizeof(GroupHdr);
+    uint8_t broadcast[] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+    Setup(broadcast);
+}
+
+void ESPNAgent::ReceiveGroupFrame(const uint8_t *pData, int len)
+{
+    GroupHdr hdr;
+    if (len <= (int)sizeof(hdr))
+        return;
+    memcpy(&hdr, pData, sizeof(hdr));
+    uint32_t bit = 1u << (hdr.group & 31);
+    if ((Groups & bit) == 0)
+        return;
+    // each device counts its own losses from the gaps in the group sequence
+    auto& last = GroupRxSeq[hdr.group & 31];
+    if (GroupSeen & bit)
     {
-        // longer timeout on the controller
-        // so we're not racing with the device to respond
-        Metro.PeriodMS += 1000;
+        uint16_t gap = hdr.seq - last - 1;
+        if (gap != 0 && gap < 0x8000)
+            GroupLost += gap;
     }
+    GroupSeen |= bit;
+    last = hdr.seq;
+    ++GroupFrames;
+    OnDataRecv(pData + sizeof(hdr), len - sizeof(hdr));
+}
+
+void ESPNAgent::RunAll()
+{
+    // rotate which peer goes first so none is always served last
+    // when the shared in-flight window is the bottleneck
+    auto count = ESPNAgents.size();
+    for (size_t i = 0; i < count; ++i)
+        ESPNAgents[(RunStart + i) % count]->Run();
+    if (count > 0)
+        RunStart = (RunStart + 1) % count;
 }
 
 void ESPNAgent::Run(void)
 {
-    // check to send next file transfer packet
-    if (FilePacketSend)
-        SendNextFilePacket();
+    while (auto ack = FileAcksOut.Front())
+    {
+        if (!TxRoom())
+            break;
+        Send((uint8_t*)ack, sizeof(*ack));
+        FileAcksOut.Pop();
+    }
+    ServiceTx();
+
+    if (TxFileCount != 0)
+        ServiceFileTransfer();
+    if (FileBufs && !FileBufs.load()->Ring.Empty())
+        ServiceFileReceive();
+
+    if (FileBufsWanted)
+    {
+        FileBufsWanted = false;
+        EnableFileReceive();
+        if (!FileBufs)
+            TerminateTransfer = true;
+    }
+    if (TerminateTransfer)
+    {
+        TerminateTransfer = false;
+        Send((uint8_t*)"4", 1);
+    }
 
     if (ConnectionChange)
     {
         ConnectionChange = false;
         pRoot->ConnectionChanged(Connected);
+        if (Connected && TxFileSuspended)
+            ResumeFileTransfer();
     }
 
-    if (Metro)
+    if (GroupId < 0)
     {
-        if (pRoot->IsDevice)
+        if (!pRoot->IsDevice)
+            AdaptTimeout();
+        if (Metro)
         {
-            // flogv("device heartbeat");
-            SendCmd(".");
-        }
-        else
-        {
-            flogv("device offline");
-            SetConnection(false);
+            if (pRoot->IsDevice)
+            {
+                // flogv("device heartbeat");
+                // back off quickly when sends fail, creep back up while they don't
+                if (LinkLossPM > LossHighPM)
+                    HeartbeatMS = HeartbeatMS / 2 < HeartbeatMinMS ? HeartbeatMinMS : HeartbeatMS / 2;
+                else if (LinkLossPM < LossLowPM)
+                    HeartbeatMS = HeartbeatMS + HeartbeatStepMS > HeartbeatMaxMS ? HeartbeatMaxMS : HeartbeatMS + HeartbeatStepMS;
+                Metro.PeriodMS = HeartbeatMS;
+                SendHeartbeat();
+            }
+            else
+            {
+                flogv("device offline");
+                SetConnection(false);
+            }
         }
     }
 
@@ -98,31 +278,29 @@ void ESPNAgent::Run(void)
 
 void ESPNAgent::OnDataSent(esp_now_send_status_t status)
 {
-    DataSent = false;
+    uint32_t sentAt;
+    if (CompleteSend(sentAt))
+    {
+        uint32_t latency = micros() - sentAt;
+        SendLatencyAvgUS = SendLatencyAvgUS == 0 ? latency : (SendLatencyAvgUS * 7 + latency) / 8;
+        if (latency > SendLatencyMaxUS)
+            SendLatencyMaxUS = latency;
+    }
+    if (GroupId < 0)
+        LinkLossPM = (LinkLossPM * 15 + (status != ESP_NOW_SEND_SUCCESS ? 1000 : 0)) / 16;
     if (status != ESP_NOW_SEND_SUCCESS)
     {
+        // lost file packets are resent from the ACK bitmaps and timeouts
         flogw("Delivery Fail");
-        SetConnection(false);
-
-        if (FilePacketCount != 0)
-        {
-            if (++FilePacketSendErrorCount > 2)
-            {
-                // retries failed
-                FilePacketSend = false;
-                floge("File transfer failed");
-            }
-            else
-            {
-                // retry
-                FilePacketSend = true;
-                floge("File transfer retry %d", FilePacketSendErrorCount);
-            }
-        }
+        // one lost frame on a marginal link isn't a lost connection
+        if (GroupId < 0 && ++SendFailures >= SendFailuresMax)
+            SetConnection(false);
     }
     else
     {
-        SetConnection(true);
+        SendFailures = 0;
+        if (GroupId < 0)
+            SetConnection(true);
     }
 }
 
@@ -131,23 +309,75 @@ void ESPNAgent::OnDataRecv(const uint8_t *pData, int len)
     SetConnection(true);
     if (len > 0)
     {
-        String data(pData, len);
-        switch (data[0])
+        switch (pData[0])
         {
         case '.':   // heartbeat from device (actions taken above are all we need)
+            {
+                // its period for the controller's timeout; absent from older devices
+                Heartbeat hb;
+                if (len >= (int)sizeof(hb))
+                {
+                    memcpy(&hb, pData, sizeof(hb));
+                    PeerHeartbeatMS = hb.periodMS;
+                }
+            }
+            break;
+        case OMB_FRAME:
+            ReceiveRecords(pData + 1, len - 1);
+            break;
+        case OMG_FRAME:
+            ReceiveGroupFrame(pData, len);
+            break;
+        case OMS_FRAME:
+            ReceiveSequenced(pData, len);
+            break;
+        case OMA_FRAME:
+            ReceiveAck(pData, len);
             break;
         case '1':
             {
                 // first file transfer packet
                 FilePacketHdr hdr;
                 memcpy(&hdr, pData, sizeof(hdr));
+                String name((char*)pData + sizeof(hdr));
+                // whole file CRC follows the name (absent from older senders)
+                uint32_t crc = 0;
+                int crcAt = sizeof(hdr) + name.length() + 1;
+                bool hasCrc = len >= crcAt + (int)sizeof(crc);
+                if (hasCrc)
+                    memcpy(&crc, pData + crcAt, sizeof(crc));
+                if (FilePacketCount == hdr.packetNum && FilePath == name && FileCrc == crc && FileId == hdr.crc)
+                {
+                    // repeated start for the current transfer: our ACK was lost
+                    // or the sender is resuming after a dropout; tell it where we are
+                    // (if we already have it all, the ACK completes the sender too)
+                    QueueFileAck();
+                    break;
+                }
+                if (!FileBufs)
+                {
+                    // not allocated here: Run does that before the sender resends the start
+                    FileBufsWanted = true;
+                    break;
+                }
+                FilePath = name;
+                FileCrc = crc;
+                FileId = hdr.crc;
+                FileVerified = false;
+                // Run opens the file; the start record orders it ahead of the data
+                uint8_t start[1 + 1 + sizeof(crc)] = { 'S', (uint8_t)hasCrc };
+                memcpy(start + 2, &crc, sizeof(crc));
+                if (!FileBufs.load()->Ring.Push(start, sizeof(start), (const uint8_t*)FilePath.c_str(), FilePath.length()))
+                {
+                    floge("file receive buffer full");
+                    FilePath = "";
+                    break;
+                }
                 FilePacketNumber = 1;
                 FilePacketCount = hdr.packetNum;
-                FilePath = String((char*)pData + sizeof(hdr));
+                FileHeld = 0;
                 flogv("Starting transfer: %s  #packets: %lu", FilePath.c_str(), FilePacketCount);
-                pFS->remove(("/" + FilePath).c_str());
-                // respond with ACK
-                Send((uint8_t*)"3", 1);
+                QueueFileAck();
             }
             break;
         case '2':
@@ -155,92 +385,45 @@ void ESPNAgent::OnDataRecv(const uint8_t *pData, int len)
                 // file transfer data packet
                 FilePacketHdr hdr;
                 memcpy(&hdr, pData, sizeof(hdr));
-                uint32_t packetNumber = hdr.packetNum;
-                if (packetNumber != FilePacketNumber)
+                if ((uint16_t)FileCrc32(0, pData + sizeof(hdr), len - sizeof(hdr)) != hdr.crc)
                 {
-                    floge("packet number %lu doesn't match expected %lu", packetNumber, FilePacketNumber);
-                    FilePacketNumber = 0;
-                    FilePacketCount = 0;
-                    FilePath = "";
-                    SendCmd("4");   // terminate transfer
-                    break;
-                }
-                //Serial.println("chunk NUMBER = " + String(currentTransmitCurrentPosition));
-                File file = pFS->open(("/" + FilePath).c_str(), FILE_APPEND);
-                if (!file)
-                {
-                    floge("Error opening file for append");
-                    FilePacketNumber = 0;
-                    FilePacketCount = 0;
-                    FilePath = "";
-                    SendCmd("4");   // terminate transfer
+                    // treat as lost; the ACKs will show the gap
+                    flogw("file packet %lu checksum error", hdr.packetNum);
                     break;
                 }
-                file.write(pData + sizeof(hdr), len - sizeof(hdr));
-                uint32_t fileSize = file.size();
-                file.close();
-                // flogv("File packet %lu of %lu received, file size: %lu", FilePacketNumber, FilePacketCount, fileSize);
-        
-                if (FilePacketNumber == FilePacketCount)
-                {
-                    FilePacketNumber = 0;
-                    FilePacketCount = 0;
-                    flogv("File transfer complete");
-                    pRoot->ReceivedFile(FilePath);
-                    FilePath = "";
-                }
-                else
-                {
-                    ++FilePacketNumber;
-                }
-                // ACK the packet
-                Send((uint8_t*)"3", 1);
+                ReceiveFilePacket(hdr.packetNum, pData + sizeof(hdr), len - sizeof(hdr));
             }
             break;
         case '3':
             {
-                // ACK received from previous file transfer packet
-                // OK the transmission of next packet
-                // flogv("File transfer ACK received");
-                ++FilePacketNumber;
-                FilePacketSend = true;
+                // ACK for our file transfer; Run acts on it
+                FileAck ack;
+                if (len < (int)sizeof(ack))
+                    break;
+                memcpy(&ack, pData, sizeof(ack));
+                TxFileAcks.Push(ack);
             }
             break;
         case '4':
             {
                 // termination received
+                if (FilePacketCount != 0)
+                    FileBufs.load()->Ring.Push((const uint8_t*)"X", 1);  // Run discards the partial file
                 FilePacketCount = 0;
                 FilePacketNumber = 0;
-                FilePacketSend = false;
                 FilePath = "";
+                TxFileTerminated = true;
                 floge("File transfer terminated");
             }
             break;
         case '[':
             // flog* output from peer just for remote diagnosis
-            Serial.print(data.c_str());
+            Serial.write(pData, len);
             break;
         default:
-            {
-                // assume anyting else is an input command
-                // queue it up
-                while (data.length() > 0)
-                {
-                    String cmd;
-                    auto inx = data.indexOf(';');
-                    if (inx == -1)
-                    {
-                        cmd = data;
-                        data.clear();
-                    }
-                    else
-                    {
-                        cmd = data.substring(0, inx);
-                        data.remove(0, inx+1);
-                    }
-                    inputCommands.push(cmd);
-                }
-            }
+            // assume anyting else is input commands
+            // queue them up
+            ReceiveCommands(pData, len);
             break;
         }
     }
@@ -248,34 +431,90 @@ void ESPNAgent::OnDataRecv(const uint8_t *pData, int len)
 
 bool ESPNAgent::Send(const uint8_t *pData, int len)
 {
-    if (DataSent)
+    if (len <= 0 || len > ESP_NOW_MAX_DATA_LEN)
     {
-        // data sent but not acknowledged; wait it out a while
-        unsigned long ms = millis();
-        while (DataSent)
-        {
-            if (millis() - ms > 100)
-                DataSent = false;
-        }
+        floge("invalid send length: %d", len);
+        return false;
     }
-    DataSent = true;
-    esp_err_t result = esp_now_send(PeerInfo.peer_addr, pData, len);
-    if (result != ESP_OK)
+    // queue the frame rather than waiting on the previous send's callback
+    TxFrame frame;
+    frame.Len = 0;
+    if (GroupId >= 0)
     {
-        SetConnection(false);
-        floge("Error sending data: %s", esp_err_to_name(result));
-        if (result == ESP_ERR_ESPNOW_ARG)
+        if (len + sizeof(GroupHdr) > ESP_NOW_MAX_DATA_LEN)
         {
-            floge("len: %d", len);
-            if (len > 0)
-                floge("data: %s", pData);
+            floge("group frame too long: %d", len);
+            return false;
         }
-        DataSent = false;
+        GroupHdr hdr = { OMG_FRAME, (uint8_t)GroupId, GroupTxSeq++ };
+        memcpy(frame.Data, &hdr, sizeof(hdr));
+        frame.Len = sizeof(hdr);
+    }
+    memcpy(frame.Data + frame.Len, pData, len);
+    frame.Len += len;
+    if (!TxQueue.Push(frame))
+    {
+        ++TxDropped;
+        flogw("transmit queue full");
         return false;
     }
+    ServiceTx();
     return true;
 }
 
+bool ESPNAgent::CompleteSend(uint32_t& sentAt)
+{
+    // retire the oldest in-flight send; called from the send callback and on timeout
+    // so guard against both retiring the same one
+    auto done = DoneSeq.load();
+    while (done != SendSeq)
+    {
+        if (DoneSeq.compare_exchange_weak(done, done + 1))
+        {
+            --InFlightAll;
+            sentAt = SentAt[done % TxWindow];
+            return true;
+        }
+    }
+    return false;
+}
+
+void ESPNAgent::ServiceTx()
+{
+    // a send whose callback is overdue is written off to reopen the window
+    if (SendSeq != DoneSeq && micros() - SentAt[DoneSeq % TxWindow] > TxTimeoutUS)
+    {
+        uint32_t sentAt;
+        if (CompleteSend(sentAt))
+        {
+            ++CallbackTimeouts;
+            flogw("send callback timeout");
+        }
+    }
+
+    while (SendSeq - DoneSeq < TxWindow && InFlightAll < TxWindowAll)
+    {
+        auto frame = TxQueue.Front();
+        if (!frame)
+            break;
+        SentAt[SendSeq % TxWindow] = micros();
+        ++InFlightAll;
+        ++SendSeq;
+        esp_err_t result = esp_now_send(PeerInfo.peer_addr, frame->Data, frame->Len);
+        if (result != ESP_OK)
+        {
+            // no callback will come for this one
+            uint32_t sentAt;
+            CompleteSend(sentAt);
+            SetConnection(false);
+            floge("Error sending data: %s", esp_err_to_name(result));
+            if (result == ESP_ERR_ESPNOW_ARG)
+                floge("len: %d", frame->Len);
+        }
+        TxQueue.Pop();
+    }
+}
+
 void ESPNAgent::SetConnection(bool connect)
 {
     if (connect)
@@ -288,75 +527,412 @@ void ESPNAgent::SetConnection(bool connect)
 
 void ESPNAgent::StartFileTransfer(String filePath)
 {
-    if (filePath.length() > 31)
+    if (GroupId >= 0)
     {
-        floge("Filename length must be < 32");
+        floge("File transfer needs a unicast agent");
         return;
     }
-    File file = pFS->open(filePath.c_str(), FILE_READ);
-    if (!file)
+    if (strlen(pathToFileName(filePath.c_str())) > FileNameMax)
+    {
+        floge("Filename length must be <= %u", FileNameMax);
+        return;
+    }
+    if (TxFileCount != 0)
+    {
+        if (!TxFileSuspended)
+        {
+            floge("File transfer already in progress");
+            return;
+        }
+        // abandon the suspended one
+        Send((uint8_t*)"4", 1);
+        EndFileTransfer();
+    }
+    TxFile = pFS->open(filePath.c_str(), FILE_READ);
+    if (!TxFile)
     {
         floge("File open failed");
         return;
     }
-    uint32_t fileSize = file.size();
-    file.close();
-    FilePacketSendErrorCount = 0;
-    // packet 0 is the start packet with filename but no data
-    FilePacketNumber = 0;
-    FilePacketCount = fileSize / FilePacketSize;
+    uint32_t fileSize = TxFile.size();
+    TxFileCount = fileSize / FilePacketSize;
     if (fileSize % FilePacketSize != 0)
-    FilePacketCount++;
-    FilePath = filePath;
-    String fileName(pathToFileName(filePath.c_str()));
-    flogv("Starting transfer: %s  file size: %lu  #packets: %lu", FilePath.c_str(), fileSize, FilePacketCount);
-    FilePacketHdr hdr = { '1', FilePacketCount };
-    uint8_t messageArray[sizeof(hdr) + fileName.length() + 1];
+        TxFileCount++;
+    if (TxFileCount == 0)
+    {
+        floge("File is empty");
+        TxFile.close();
+        return;
+    }
+    // packet 0 is the start packet with filename but no data
+    TxFileBase = 0;
+    TxFileNext = 1;
+    TxFileResentBase = 0;
+    TxFileRetries = 0;
+    TxFileResumes = 0;
+    TxFileSuspended = false;
+    TxFileTerminated = false;
+    while (TxFileAcks.Front())
+        TxFileAcks.Pop();
+    // whole file CRC for the receiver to verify
+    TxFileCrc = 0;
+    uint8_t buf[FilePacketSize];
+    size_t n;
+    while ((n = TxFile.read(buf, sizeof(buf))) > 0)
+        TxFileCrc = FileCrc32(TxFileCrc, buf, n);
+    TxFile.seek(0);
+    TxFileName = pathToFileName(filePath.c_str());
+    TxFileId = esp_random();
+    flogv("Starting transfer: %s  file size: %lu  #packets: %lu", filePath.c_str(), fileSize, TxFileCount);
+    SendFileStart();
+}
+
+void ESPNAgent::SendFileStart()
+{
+    FilePacketHdr hdr = { '1', TxFileId, TxFileCount };
+    uint8_t messageArray[sizeof(hdr) + TxFileName.length() + 1 + sizeof(TxFileCrc)];
     memcpy(messageArray, &hdr, sizeof(hdr));
-    strcpy((char*)(messageArray + sizeof(hdr)), fileName.c_str());
+    strcpy((char*)(messageArray + sizeof(hdr)), TxFileName.c_str());
+    memcpy(messageArray + sizeof(hdr) + TxFileName.length() + 1, &TxFileCrc, sizeof(TxFileCrc));
     Send(messageArray, sizeof(messageArray));
+    TxFileProgressMS = millis();
 }
 
-void ESPNAgent::SendNextFilePacket()
+bool ESPNAgent::SendFilePacket(uint32_t packetNum)
 {
-    FilePacketSend = false;
+    uint32_t packetDataSize = FilePacketSize;
+    if (packetNum == TxFileCount)
+    {
+        // last packet - adjust the size
+        packetDataSize = TxFile.size() - ((TxFileCount - 1) * FilePacketSize);
+    }
+    FilePacketHdr hdr = { '2', 0, packetNum };
+    uint8_t messageArray[sizeof(hdr) + packetDataSize];
+    // sequential sends need no seek; resends do
+    uint32_t pos = (packetNum - 1) * FilePacketSize;
+    if (TxFile.position() != pos)
+        TxFile.seek(pos);
+    TxFile.read(messageArray + sizeof(hdr), packetDataSize);
+    hdr.crc = FileCrc32(0, messageArray + sizeof(hdr), packetDataSize);
+    memcpy(messageArray, &hdr, sizeof(hdr));
+    return Send(messageArray, sizeof(messageArray));
+}
 
-    // if got to AFTER the last package
-    if (FilePacketNumber > FilePacketCount)
+void ESPNAgent::EndFileTransfer()
+{
+    TxFile.close();
+    TxFileCount = 0;
+    TxFileBase = 0;
+    TxFileNext = 0;
+    TxFileSuspended = false;
+    TxFileName = "";
+}
+
+void ESPNAgent::ResumeFileTransfer()
+{
+    // restart from the receiver's confirmed position: the start packet gets it to ACK where it is
+    if (++TxFileResumes > FileMaxResumes)
+    {
+        floge("File transfer failed");
+        Send((uint8_t*)"4", 1);
+        EndFileTransfer();
+        return;
+    }
+    flogi("File transfer resume %d", TxFileResumes);
+    TxFileSuspended = false;
+    TxFileBase = 0;
+    TxFileNext = 1;
+    TxFileResentBase = 0;
+    TxFileRetries = 0;
+    SendFileStart();
+}
+
+void ESPNAgent::ServiceFileTransfer()
+{
+    if (TxFileTerminated)
+    {
+        EndFileTransfer();
+        return;
+    }
+
+    if (TxFileSuspended)
+    {
+        // wait out the dropout; reconnection (see Run) or the resume period picks it up again
+        if (Connected && millis() - TxFileProgressMS > FileResumeMS)
+            ResumeFileTransfer();
+        return;
+    }
+
+    while (auto ack = TxFileAcks.Front())
+    {
+        if (ack->base > TxFileBase)
+        {
+            TxFileBase = ack->base;
+            TxFileProgressMS = millis();
+            TxFileRetries = 0;
+            if (TxFileNext < TxFileBase)
+                TxFileNext = TxFileBase;
+        }
+        if (ack->base == TxFileBase && ack->bits != 0 && TxFileResentBase != TxFileBase)
+        {
+            // the receiver holds packets past a gap: resend just the missing ones, once per gap
+            // (those after the last held packet may still be in flight)
+            TxFileResentBase = TxFileBase;
+            uint32_t last = TxFileBase;
+            for (uint8_t i = 0; i < 32; ++i)
+            {
+                if (ack->bits & (1u << i))
+                    last = TxFileBase + 1 + i;
+            }
+            for (uint32_t n = TxFileBase; n < last; ++n)
+            {
+                if (n > TxFileBase && (ack->bits & (1u << (n - TxFileBase - 1))))
+                    continue;
+                if (!TxRoom())
+                    break;
+                SendFilePacket(n);
+            }
+        }
+        TxFileAcks.Pop();
+    }
+
+    if (TxFileBase > TxFileCount)
     {
-        FilePacketNumber = 0;
-        FilePacketCount = 0;
-        FilePath = "";
         flogv("File transfer complete");
+        EndFileTransfer();
         return;
     }
 
-    File file = pFS->open(FilePath.c_str(), FILE_READ);
-    if (!file)
+    if (millis() - TxFileProgressMS > FileTimeoutMS)
     {
-        FilePacketNumber = 0;
-        FilePacketCount = 0;
-        FilePath = "";
-        floge("File open failed");
+        // ACKs stopped: resend the oldest outstanding packet (or the start) to provoke a fresh ACK
+        if (++TxFileRetries > FileMaxRetries)
+        {
+            // keep the file and position; the receiver keeps its partial file
+            flogw("File transfer suspended at packet %lu of %lu", TxFileBase, TxFileCount);
+            TxFileSuspended = true;
+            TxFileProgressMS = millis();
+            return;
+        }
+        floge("File transfer retry %d", TxFileRetries);
+        if (TxFileBase == 0)
+            SendFileStart();
+        else
+            SendFilePacket(TxFileBase);
+        TxFileResentBase = 0;
+        TxFileProgressMS = millis();
         return;
     }
 
-    uint32_t packetDataSize = FilePacketSize;
-    if (FilePacketNumber == FilePacketCount)
+    // fill the window with new packets
+    while (TxFileBase != 0 && TxFileNext <= TxFileCount && TxFileNext < TxFileBase + FileWindow && TxRoom())
     {
-        // last packet - adjust the size
-        packetDataSize = file.size() - ((FilePacketCount - 1) * FilePacketSize);
-        // flogv("Last file packet data size: %lu", packetDataSize);
+        if (!SendFilePacket(TxFileNext))
+            break;
+        ++TxFileNext;
     }
+}
 
-    FilePacketHdr hdr = { '2', FilePacketNumber };
-    uint8_t messageArray[sizeof(hdr) + packetDataSize];
-    memcpy(messageArray, &hdr, sizeof(hdr));
+void ESPNAgent::EnableFileReceive()
+{
+    if (FileBufs)
+        return;
+    FileBufs = new (std::nothrow) FileBuffers;
+    if (!FileBufs)
+        floge("no memory for file receive");
+}
 
-    // we'll increment the FilePacketNumber in OnDataSent when packet transmission is confirmed
+void ESPNAgent::QueueFileAck()
+{
+    // all received but not yet in place: hold back the final ACK
+    uint32_t base = FilePacketNumber;
+    if (base > FilePacketCount && !FileVerified)
+        base = FilePacketCount;
+    FileAck ack = { '3', base, FileHeld >> 1 };
+    FileAcksOut.Push(ack);
+}
 
-    file.seek((FilePacketNumber - 1) * FilePacketSize);
-    file.readBytes((char*)messageArray + sizeof(hdr), packetDataSize);
-    file.close();
-    Send(messageArray, sizeof(messageArray));
+void ESPNAgent::ServiceFileReceive()
+{
+    // the receive callback only queues; file system work happens here on the loop task
+    uint8_t rec[1 + FilePacketSize + 32];
+    uint16_t len;
+    auto fb = FileBufs.load();
+    while ((len = fb->Ring.Pop(rec, sizeof(rec))) > 0)
+    {
+        switch (rec[0])
+        {
+        case 'S':   // start: has CRC, CRC, path
+            {
+                if (RxFile)
+                    RxFile.close();
+                RxFileHasCrc = rec[1] != 0;
+                memcpy(&RxFileCrcExpected, rec + 2, sizeof(RxFileCrcExpected));
+                RxFileCrc = 0;
+                RxFileBufLen = 0;
+                RxFilePath = "/" + String(rec + 6, len - 6);
+                // written under a temporary name; the existing file survives until the new one is verified
+                pFS->remove((RxFilePath + "~").c_str());
+                RxFile = pFS->open((RxFilePath + "~").c_str(), FILE_WRITE);
+                if (!RxFile)
+                {
+                    floge("Error opening file for write");
+                    Send((uint8_t*)"4", 1);
+                }
+            }
+            break;
+        case 'D':   // data
+            if (!RxFile)
+                break;
+            RxFileCrc = FileCrc32(RxFileCrc, rec + 1, len - 1);
+            for (uint16_t i = 1; i < len; )
+            {
+                // gather into page sized writes
+                uint16_t n = len - i;
+                if (n > FileWriteSize - RxFileBufLen)
+                    n = FileWriteSize - RxFileBufLen;
+                memcpy(fb->WriteBuf + RxFileBufLen, rec + i, n);
+                RxFileBufLen += n;
+                i += n;
+                if (RxFileBufLen == FileWriteSize && !FlushFileReceive())
+                    break;
+            }
+            break;
+        case 'E':   // all data received: packet count
+            {
+                if (!RxFile)
+                    break;
+                bool ok = FlushFileReceive();
+                RxFile.close();
+                if (ok && RxFileHasCrc && RxFileCrc != RxFileCrcExpected)
+                {
+                    floge("File CRC mismatch: %08lx expected %08lx", RxFileCrc, RxFileCrcExpected);
+                    ok = false;
+                }
+                if (ok)
+                {
+                    // LittleFS replaces an existing file in the rename itself;
+                    // SPIFFS won't rename over one, so there it has to go first
+                    ok = pFS->rename((RxFilePath + "~").c_str(), RxFilePath.c_str());
+                    if (!ok && pFS->exists(RxFilePath.c_str()))
+                    {
+                        pFS->remove(RxFilePath.c_str());
+                        ok = pFS->rename((RxFilePath + "~").c_str(), RxFilePath.c_str());
+                    }
+                    if (!ok)
+                        floge("File rename failed");
+                }
+                if (!ok)
+                {
+                    // the sender is still waiting on the final ACK
+                    pFS->remove((RxFilePath + "~").c_str());
+                    Send((uint8_t*)"4", 1);
+                    break;
+                }
+                FileVerified = true;
+                uint32_t count;
+                memcpy(&count, rec + 1, sizeof(count));
+                FileAck ack = { '3', count + 1, 0 };
+                Send((uint8_t*)&ack, sizeof(ack));
+                flogv("File transfer complete");
+                pRoot->ReceivedFile(RxFilePath.substring(1));
+            }
+            break;
+        case 'X':   // terminated by the sender
+            if (RxFile)
+            {
+                RxFile.close();
+                pFS->remove((RxFilePath + "~").c_str());
+            }
+            break;
+        }
+    }
+}
+
+bool ESPNAgent::FlushFileReceive()
+{
+    if (RxFileBufLen == 0)
+        return true;
+    auto written = RxFile.write(FileBufs.load()->WriteBuf, RxFileBufLen);
+    bool ok = written == RxFileBufLen;
+    RxFileBufLen = 0;
+    if (!ok)
+    {
+        floge("Error writing file");
+        RxFile.close();
+        pFS->remove((RxFilePath + "~").c_str());
+        Send((uint8_t*)"4", 1);
+    }
+    return ok;
+}
+
+void ESPNAgent::ReceiveFilePacket(uint32_t packetNum, const uint8_t *pData, int len)
+{
+    if (FilePacketCount == 0)
+    {
+        floge("file packet %lu with no transfer in progress", packetNum);
+        TerminateTransfer = true;   // Run sends the terminate command
+        return;
+    }
+    auto fb = FileBufs.load();
+    if (packetNum < FilePacketNumber)
+    {
+        // duplicate (also after completion): the sender missed our ACK
+        QueueFileAck();
+        return;
+    }
+    uint32_t offset = packetNum - FilePacketNumber;
+    if (offset >= FileWindow || packetNum > FilePacketCount || len > FilePacketSize)
+    {
+        floge("file packet %lu outside window at %lu", packetNum, FilePacketNumber);
+        return;
+    }
+    if (offset > 0)
+    {
+        // early: hold it until the gap is filled and tell the sender what is missing
+        auto slot = packetNum % FileWindow;
+        memcpy(fb->Slots[slot], pData, len);
+        fb->SlotLen[slot] = len;
+        FileHeld |= 1u << offset;
+        QueueFileAck();
+        return;
+    }
+
+    // in order: queue it and any held packets that now follow for Run to write
+    // if the buffer can't take them all, drop this packet; the sender resends it
+    uint32_t needed = 2 + 1 + len;
+    uint8_t run = 1;
+    for (; run < FileWindow && (FileHeld & (1u << run)); ++run)
+        needed += 2 + 1 + fb->SlotLen[(packetNum + run) % FileWindow];
+    // and the end record if these finish the file
+    if (packetNum + run > FilePacketCount)
+        needed += 2 + 1 + sizeof(FilePacketCount);
+    if (fb->Ring.Free() < needed)
+    {
+        flogw("file receive buffer full");
+        return;
+    }
+    const uint8_t tag = 'D';
+    fb->Ring.Push(&tag, 1, pData, len);
+    ++FilePacketNumber;
+    FileHeld >>= 1;
+    while (FileHeld & 1)
+    {
+        auto slot = FilePacketNumber % FileWindow;
+        fb->Ring.Push(&tag, 1, fb->Slots[slot], fb->SlotLen[slot]);
+        ++FilePacketNumber;
+        FileHeld >>= 1;
+    }
+
+    if (FilePacketNumber > FilePacketCount)
+    {
+        // keep FilePacketNumber/Count so late duplicates are re-ACKed rather than rejected
+        // Run sends the final ACK once the file checks out
+        const uint8_t end = 'E';
+        fb->Ring.Push(&end, 1, (const uint8_t*)&FilePacketCount, sizeof(FilePacketCount));
+        return;
+    }
+    // ACK every other packet in steady state; the sender's window covers the gap
+    if ((FilePacketNumber & 1) == 0 || FileHeld != 0)
+        QueueFileAck();
 }
@@ -3,44 +3,210 @@
 #include <Arduino.h>
 #include <esp_now.h>
 #include <WiFi.h>
-#include <queue>
+#include <esp_wifi.h>
+#include <atomic>
 #include "FS.h"
 #include "Agent.h"
+#include "SpscQueue.h"
 #include "Metronome.h"
 
+// group frame: GroupHdr followed by an ordinary frame
+// sent once to the broadcast address and applied by every device in the group
+const uint8_t OMG_FRAME = 0x02;
+
 class ESPNAgent : public Agent
 {
 public:
     ESPNAgent(FS* pfs, Root* proot) : Agent(pfs, proot), Metro(5000) { };
     void    Setup(uint8_t peerMacAddress[]);
+    // controller: make this the (single) agent broadcasting pRoot's changes to group groupId
+    // the group Root holds the subtree the devices share; it stays on text commands
+    // unless the application knows every device's tree matches and sets BinaryPeer itself
+    void    SetupGroup(uint8_t groupId);
+    // device: apply group frames for groupId arriving from this agent's peer
+    void    JoinGroup(uint8_t groupId) { Groups |= 1u << (groupId & 31); }
     void    Run() override;
     bool    Send(const uint8_t *pData, int len) override;
     void    StartFileTransfer(String filePath) override;
+    // allocate the file receive buffers now rather than when the first transfer starts
+    void    EnableFileReceive();
     void    OnDataSent(esp_now_send_status_t status);
     void    OnDataRecv(const uint8_t *pData, int len);
 
-    static ESPNAgent* FindAgent(const uint8_t* peerMacAddress);
+    static ESPNAgent* FindAgent(const uint8_t* peerMacAddress, bool quiet = false);
     static ESPNAgent* PrimaryAgent() { return ESPNAgents[0]; }
+    // run every registered agent, in round-robin order, for a controller driving several peers
+    static void RunAll();
+
+    // transmit statistics
+    uint32_t    SendLatencyAvgUS = 0;       // esp_now_send to send callback, moving average
+    uint32_t    SendLatencyMaxUS = 0;
+    uint32_t    CallbackTimeouts = 0;       // sends whose callback never came
+    uint32_t    TxDropped = 0;              // frames lost to a full transmit queue
+    // group receive statistics
+    uint32_t    GroupFrames = 0;
+    uint32_t    GroupLost = 0;              // frames missing from the sequence
+    // LinkRssi of every agent, from frames overheard in promiscuous mode; off by default, as it means
+    // a callback for every management frame on the channel; call after the first Setup
+    static void TrackRssi(bool enable);
+    // receive callback for the RSSI of ESP-NOW frames, which the receive callback doesn't report
+    static void OnPromiscuousRecv(void* buf, wifi_promiscuous_pkt_type_t type);
 private:
     esp_now_peer_info_t PeerInfo;
     static std::vector<ESPNAgent*> ESPNAgents;
+    // MAC address hash to agent, open addressed, for the per-frame callback lookups
+    static const uint8_t PeerTableSize = 32;    // at most half full; ESP-NOW allows 20 peers
+    static ESPNAgent* PeerTable[PeerTableSize];
+    static uint8_t PeerHash(const uint8_t* mac);
+    static size_t RunStart;                     // RunAll's first agent, rotated each call
 	Metronome	Metro;
     void SetConnection(bool connect);
-    bool DataSent = false;
+
+    // heartbeat
+    //  '.' Heartbeat - the device sends one when it has sent nothing for HeartbeatMS
+    // the device shortens the period while sends are failing and lengthens it while they aren't;
+    // the controller waits the announced period plus a margin before declaring it offline
+    struct Heartbeat
+    {
+        char        tag;
+        uint16_t    periodMS;   // sender's period until the next heartbeat
+    };
+    static const uint16_t HeartbeatMinMS = 1000;
+    static const uint16_t HeartbeatMaxMS = 5000;
+    static const uint16_t HeartbeatStepMS = 500;    // lengthened by this per heartbeat on a good link
+    static const uint16_t LossHighPM = 100;         // halve the period above this loss
+    static const uint16_t LossLowPM = 20;           // lengthen it below this
+    static const uint16_t TimeoutMarginMS = 250;    // at least; more on a slow link
+    std::atomic<uint16_t> PeerHeartbeatMS { 0 };    // announced by the device; 0 until one arrives
+    void    SendHeartbeat();
+    void    AdaptTimeout();
+
+    // frames waiting for the in-flight window
+    // Send queues them and returns; Run and Send move them to ESP-NOW as callbacks free the window
+    struct TxFrame
+    {
+        uint8_t     Len;
+        uint8_t     Data[ESP_NOW_MAX_DATA_LEN];
+    };
+    static const uint8_t TxWindow = 2;          // sends outstanding before waiting for callbacks
+    static const uint32_t TxTimeoutUS = 100000; // give up on a send callback after this
+    static const uint8_t TxWindowAll = 4;       // sends outstanding across all agents
+    static std::atomic<uint8_t> InFlightAll;
+    OMSpscQueue<TxFrame, 8> TxQueue;
+    uint32_t    SentAt[TxWindow];               // micros() of each in-flight send
+    std::atomic<uint32_t> SendSeq { 0 };        // sends started (loop task)
+    std::atomic<uint32_t> DoneSeq { 0 };        // sends completed or timed out
+    void    ServiceTx();
+    bool    CompleteSend(uint32_t& sentAt);
+    bool    TxRoom() { return TxQueue.Size() < 8; }
+
+    // group
+    struct GroupHdr
+    {
+        uint8_t     tag;
+        uint8_t     group;
+        uint16_t    seq;
+    };
+    int16_t         GroupId = -1;           // group sent to, or -1 for a unicast agent
+    uint16_t        GroupTxSeq = 0;
+    uint32_t        Groups = 0;             // groups joined (bit per group id)
+    uint32_t        GroupSeen = 0;          // groups with a sequence number seen
+    uint16_t        GroupRxSeq[32];
+    void    ReceiveGroupFrame(const uint8_t *pData, int len);
+
     bool Connected = false;
     bool ConnectionChange = false;
+    static const uint8_t SendFailuresMax = 3;   // failed sends in a row before the connection counts as lost
+    uint8_t SendFailures = 0;                   // send callback
+    bool TerminateTransfer = false;     // set by the receive callback, which must not queue output itself
+
+    // file transfer
+    //  '1' start:  FilePacketHdr (packetNum = packet count) + file name
+    //  '2' data:   FilePacketHdr (packetNum = 1..count) + up to FilePacketSize bytes
+    //  '3' ACK:    FileAck - cumulative next expected packet plus a selective bitmap of those held beyond it
+    //  '4' terminate
+    // the sender keeps up to FileWindow packets in flight and resends only the ones the ACKs show missing
+    // a stalled transfer is suspended rather than abandoned and resumes from the receiver's position,
+    // which the receiver reports when it sees a repeated start for the transfer it has in progress
+    // the final ACK waits for the file to be verified and in place; if that fails the receiver terminates
     struct FilePacketHdr
     {
         char        tag;
-        uint32_t    packetNum;
+        uint16_t    crc;        // data: low 16 bits of the data's CRC-32; start: transfer id
+        uint32_t    packetNum;  // (crc fits the padding so the header stays 8 bytes)
+    };
+    struct FileAck
+    {
+        char        tag;
+        uint32_t    base;       // all packets before this received
+        uint32_t    bits;       // bit i: packet base + 1 + i received
     };
 
-    const uint16_t  FilePacketSize = 240;           // amount of file data in packet
+    static const uint16_t FilePacketSize = 240;     // amount of file data in packet
+    static const uint8_t FileWindow = 8;            // packets in flight; at most 32 for the ACK bitmap
+    static const uint32_t FileTimeoutMS = 500;      // resend when ACKs stop making progress
+    static const uint8_t FileMaxRetries = 6;        // timeouts before suspending
+    static const uint32_t FileResumeMS = 5000;      // retry a suspended transfer this often while connected
+    static const uint8_t FileMaxResumes = 10;
+    static const uint8_t FileNameMax = 29;          // "/" + name + "~" within SPIFFS's 31 characters
+
+    // sender (loop task)
+    File            TxFile;                         // held open for the whole transfer
+    uint32_t        TxFileCount = 0;                // packets in current file transfer
+    uint32_t        TxFileBase = 0;                 // first packet not yet acknowledged; 0 until start is ACKed
+    uint32_t        TxFileNext = 0;                 // next packet never sent
+    uint32_t        TxFileResentBase = 0;           // base whose gaps were already resent
+    uint32_t        TxFileProgressMS = 0;           // millis() of the last ACK progress
+    uint8_t         TxFileRetries = 0;
+    uint8_t         TxFileResumes = 0;
+    bool            TxFileSuspended = false;
+    String          TxFileName;
+    uint32_t        TxFileCrc = 0;
+    uint16_t        TxFileId = 0;                   // new for each StartFileTransfer; kept by resumes
+    OMSpscQueue<FileAck, 8> TxFileAcks;             // ACKs from the receive callback
+    std::atomic<bool> TxFileTerminated { false };   // peer terminated the transfer
+    void    ServiceFileTransfer();
+    bool    SendFilePacket(uint32_t packetNum);
+    void    SendFileStart();
+    void    EndFileTransfer();
+    void    ResumeFileTransfer();
+
+    // receiver (receive callback)
     uint32_t        FilePacketCount = 0;            // packets in current file transfer
-    uint32_t        FilePacketNumber = 0;           // current packet number
+    uint32_t        FilePacketNumber = 0;           // next in order packet expected
+    uint32_t        FileHeld = 0;                   // bit i: packet FilePacketNumber + i held in Slots
     String          FilePath;                       // path to transfered file
-    bool            FilePacketSend = false;         // flag to allow next packet to be sent
-    uint8_t         FilePacketSendErrorCount = 0;   // error count for sent packets
+    uint32_t        FileCrc = 0;                    // whole file CRC from the start packet
+    uint16_t        FileId = 0;                     // transfer id from the start packet
+    std::atomic<bool> FileVerified { false };       // set by Run once the received file is in place
+    OMSpscQueue<FileAck, 8> FileAcksOut;            // ACKs for Run to send
+    void    ReceiveFilePacket(uint32_t packetNum, const uint8_t *pData, int len);
+    void    QueueFileAck();
+
+    // receiver (loop task)
+    // the file is held open for the transfer and written in FileWriteSize pieces
+    // to RxFilePath + "~", renamed over RxFilePath once the whole file CRC checks out
+    static const uint16_t FileWriteSize = 1024;     // a multiple of the flash page size
+    File            RxFile;
+    String          RxFilePath;
+    uint16_t        RxFileBufLen = 0;
+    uint32_t        RxFileCrc = 0;
+    uint32_t        RxFileCrcExpected = 0;
+    bool            RxFileHasCrc = false;
+    void    ServiceFileReceive();
+    bool    FlushFileReceive();
 
-    void    SendNextFilePacket();
-};
+    // receive buffers, allocated on the loop task by EnableFileReceive and kept; if a transfer starts
+    // without them the start goes unanswered while Run allocates them, and the sender's resend finds them
+    // an agent that only sends files (a controller driving several devices) never carries them
+    struct FileBuffers
+    {
+        uint8_t     Slots[FileWindow][FilePacketSize];  // held early packets
+        uint16_t    SlotLen[FileWindow];
+        // in order file data and start ('S'), data ('D'), end ('E') and abort ('X') records for Run
+        OMSliceRing<4096> Ring;
+        uint8_t     WriteBuf[FileWriteSize];            // loop task
+    };
+    std::atomic<FileBuffers*> FileBufs { nullptr };
+    std::atomic<bool> FileBufsWanted { false };     // set by the receive callback
+};
\ No newline at end of file
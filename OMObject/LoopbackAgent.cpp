@@ -0,0 +1,55 @@
+#include "LoopbackAgent.h"
+#include "FLogger.h"
+
+void LoopbackAgent::Setup(LoopbackAgent* peer)
+{
+    Peer = peer;
+    peer->Peer = this;
+    // connected from the start; the Roots hear about it from their first Run
+    ConnectionChange = true;
+    peer->ConnectionChange = true;
+}
+
+void LoopbackAgent::Run()
+{
+    if (ConnectionChange)
+    {
+        ConnectionChange = false;
+        pRoot->ConnectionChanged(true);
+    }
+    Agent::Run();
+}
+
+bool LoopbackAgent::Send(const uint8_t *pData, int len)
+{
+    if (!Peer)
+    {
+        floge("loopback agent not paired");
+        return false;
+    }
+    ++FramesOut;
+    BytesOut += len;
+    Peer->Receive(pData, len);
+    return true;
+}
+
+void LoopbackAgent::Receive(const uint8_t *pData, int len)
+{
+    if (len <= 0)
+        return;
+    if (pData[0] == OMB_FRAME)
+        ReceiveRecords(pData + 1, len - 1);
+    else
+        ReceiveCommands(pData, len);
+}
+
+void LoopbackAgent::StartFileTransfer(String filePath)
+{
+    if (!Peer)
+    {
+        floge("loopback agent not paired");
+        return;
+    }
+    flogi("loopback file transfer: %s", filePath.c_str());
+    Peer->pRoot->ReceivedFile(filePath);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <Arduino.h>
+#include "FS.h"
+#include "Agent.h"
+
+// connects two Roots in the same program, as controller and device would be over a radio
+// frames are handed straight to the peer's input queue, so both agents must be Run from the same task
+class LoopbackAgent : public Agent
+{
+public:
+    LoopbackAgent(FS* pfs, Root* proot) : Agent(pfs, proot) { };
+    // pair with the agent of the other Root; call once, on either agent
+    void    Setup(LoopbackAgent* peer);
+    void    Run() override;
+    bool    Send(const uint8_t *pData, int len) override;
+    // both ends share the file system, so there is nothing to copy; the peer is just told
+    void    StartFileTransfer(String filePath) override;
+
+    uint32_t    FramesOut = 0;
+    uint32_t    BytesOut = 0;
+private:
+    LoopbackAgent*  Peer = nullptr;
+    bool            ConnectionChange = false;
+    void    Receive(const uint8_t *pData, int len);
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <Arduino.h>
+
+// compact binary encoding of property values
+// used in place of "=path value" text commands between peers whose trees match
+// (see Root::BinaryWire)
+//
+// frame:   OMB_FRAME record record ...
+// record:  length handle payload
+//          length  - bytes in handle + payload
+//          handle  - varint index of the property in traversal order
+//          payload - OMT_LONG:   varint steps above Min ((Value - Min) / Step)
+//                    OMT_BOOL:   1 byte
+//                    OMT_CHAR:   1 byte
+//                    OMT_STRING: raw bytes to the end of the record
+
+const uint8_t OMB_FRAME = 0x01;         // frame tag; never the first byte of a text command
+const uint8_t OMRecordMax = 64;         // longer values are sent as text commands
+const uint16_t OMNoHandle = 0xFFFF;
+
+struct OMRecord
+{
+    uint8_t     Len = 0;
+    uint8_t     Data[OMRecordMax];
+};
+
+// write v as a varint (7 bits per byte, low bits first)
+// returns the number of bytes written (at most 5)
+inline uint8_t OMPutVarint(uint8_t* p, uint32_t v)
+{
+    uint8_t n = 0;
+    while (v >= 0x80)
+    {
+        p[n++] = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+// read a varint from at most len bytes
+// returns the number of bytes consumed or 0 if the varint is truncated or malformed
+inline uint8_t OMGetVarint(const uint8_t* p, uint8_t len, uint32_t& v)
+{
+    v = 0;
+    for (uint8_t n = 0; n < len && n < 5; ++n)
+    {
+        v |= (uint32_t)(p[n] & 0x7F) << (7 * n);
+        if ((p[n] & 0x80) == 0)
+            return n + 1;
+    }
+    return 0;
+}
@@ -1,65 +1,28 @@
 #include "OMObject.h"
 #include "Agent.h"
-#include <Preferences.h>
+#include "OMPrefs.h"
+#include <algorithm>
 
 const char* OMPrefNamespace = "OM";
 
-void OMProperty::SavePref()
+bool OMProperty::IsPersisted()
 {
-    if ((Flags & (OMF_RO_DEVICE | OMF_WO_DEVICE)) != 0 && ((Root*)MyRoot())->IsDevice)
-        return;
-    Preferences prefs;
-    auto path = GetPath();
-    String v = ToString();
-    prefs.begin(OMPrefNamespace, false);
-    flogi("save pref: %s.%s [%s]", Parent->Name, Name, v);
-    auto ret = prefs.putString(path.c_str(), v);
-    if (ret == 0)
-        floge("preferences write error property path: %s  name: %s  pref: [%s]", path, Name, v);
-    prefs.end();
+    return (Flags & (OMF_RO_DEVICE | OMF_WO_DEVICE)) == 0 || !((Root*)MyRoot())->IsDevice;
 }
 
-void OMProperty::LoadPref()
+void OMProperty::Changed()
 {
-    if ((Flags & (OMF_RO_DEVICE | OMF_WO_DEVICE)) != 0 && ((Root*)MyRoot())->IsDevice)
-        return;
-    Preferences prefs;
-    auto path = GetPath();
-    prefs.begin(OMPrefNamespace, false);
-    String v = prefs.isKey(path.c_str()) ? prefs.getString(path.c_str()) : "";
-    if (v.length() > 0)
-    {
-        flogv("load pref: %s.%s [%s]", Parent->Name, Name, v);
-        FromString(v);
-    }
-    prefs.end();
+    auto root = (Root*)MyRoot();
+    root->MarkChanged(this);
+    if ((Flags & OMF_PERSIST) != 0)
+        root->MarkPersist(this);
 }
 
-void OMProperty::DumpPref()
-{
-    Preferences prefs;
-    auto path = GetPath();
-    prefs.begin(OMPrefNamespace, false);
-    if (prefs.isKey(path.c_str()))
-    {
-        String v = prefs.getString(path.c_str());
-        flogi("dump pref: %s.%s [%s]", Parent->Name, Name, v);
-    }
-    prefs.end();
-}
-
-void OMProperty::RemovePref()
-{
-    Preferences prefs;
-    auto path = GetPath();
-    prefs.begin(OMPrefNamespace, false);
-    if (prefs.isKey(path.c_str()))
-    {
-        prefs.remove(path.c_str());
-        flogi("remove pref: %s.%s", Parent->Name, Name);
-    }
-    prefs.end();
-}
+// single property preferences; use an OMPrefs directly to batch several
+void OMProperty::SavePref() { OMPrefs().Save(this); }
+void OMProperty::LoadPref() { OMPrefs().Load(this); }
+void OMProperty::DumpPref() { OMPrefs().Dump(this); }
+void OMProperty::RemovePref() { OMPrefs().Remove(this); }
 
 void OMProperty::Dump()
 {
@@ -68,12 +31,18 @@ void OMProperty::Dump()
 }
 
 void OMProperty::Send()
+{
+    if (IsSent())
+        ((Root*)MyRoot())->SendProperty(this);
+}
+
+bool OMProperty::IsSent()
 {
     if ((Flags & OMF_LOCAL) != 0)
-        return;
+        return false;
     if ((Flags & OMF_WO_DEVICE) != 0 && ((Root*)MyRoot())->IsDevice)
-        return;
-    ((Root*)MyRoot())->SendCmd(String('=') + GetPath() + ToString());
+        return false;
+    return true;
 }
 
 void OMProperty::Pull()
@@ -94,7 +63,130 @@ void OMProperty::Push()
         obj->Connector->Push(obj, this);
 }
 
-OMNode* OMObject::NodeFromPath(String path, int& inx)
+void* OMPool::Alloc(size_t bytes)
+{
+    bytes = Align(bytes);
+    if (Used + bytes > Size)
+    {
+        if (Overflow == 0)
+            flogw("object pool of %u bytes exhausted; using heap", Size);
+        Overflow += bytes;
+        return ::operator new(bytes);
+    }
+    auto p = Buffer + Used;
+    Used += bytes;
+    return p;
+}
+
+// construct a node in the pool if there is one, otherwise on the heap
+template <typename T, typename... Args> T* OMNew(OMPool* pool, Args... args)
+{
+    if (pool)
+        return new (pool->Alloc(sizeof(T))) T(args...);
+    return new T(args...);
+}
+
+void OMPathIndex::Insert(OMNode* parent, char id, OMNode* node)
+{
+    auto h = Hash(parent, id);
+    while (Slots[h].Node)
+    {
+        // objects are added ahead of properties so a shared Id resolves to the object,
+        // matching the order NodeFromPath searches in
+        if (Slots[h].Parent == parent && Slots[h].Id == id)
+            return;
+        h = (h + 1) & (Slots.size() - 1);
+    }
+    Slots[h] = { parent, node, id };
+    ++Count;
+}
+
+void OMPathIndex::Add(OMObject* obj)
+{
+    for (auto o : obj->Objects)
+        Insert(obj, o->Id, o);
+    for (auto p : obj->Properties)
+        Insert(obj, p->Id, p);
+    for (auto o : obj->Objects)
+        Add(o);
+}
+
+void OMPathIndex::Build(OMObject* root)
+{
+    Clear();
+    size_t nodes = 0;
+    std::vector<OMObject*> stack { root };
+    while (!stack.empty())
+    {
+        auto o = stack.back();
+        stack.pop_back();
+        nodes += o->Objects.size() + o->Properties.size();
+        for (auto sub : o->Objects)
+            stack.push_back(sub);
+    }
+    // keep the load factor at or below 1/2 so probe chains stay short
+    size_t size = 16;
+    while (size < nodes * 2)
+        size <<= 1;
+    Slots.assign(size, Slot { nullptr, nullptr, 0 });
+    Add(root);
+    flogv("path index: %u nodes  %u slots", Count, Slots.size());
+}
+
+OMNode* OMPathIndex::Find(OMNode* parent, char id)
+{
+    auto h = Hash(parent, id);
+    while (Slots[h].Node)
+    {
+        if (Slots[h].Parent == parent && Slots[h].Id == id)
+            return Slots[h].Node;
+        h = (h + 1) & (Slots.size() - 1);
+    }
+    return nullptr;
+}
+
+OMNode* OMPathIndex::Resolve(OMObject* start, const String& path, int& inx)
+{
+    // same greedy semantics as OMObject::WalkPath:
+    // descend through objects, stop after a property or at the first unknown Id
+    OMNode* node = nullptr;
+    OMNode* cur = start;
+    while (inx < path.length())
+    {
+        auto n = Find(cur, path[inx]);
+        if (!n)
+            break;
+        ++inx;
+        node = n;
+        if (!n->IsObject())
+            break;
+        cur = n;
+    }
+    return node;
+}
+
+OMNode* OMObject::NodeFromPath(const String& path, int& inx)
+{
+    auto index = ((OMObject*)MyRoot())->GetPathIndex();
+    if (index)
+        return index->Resolve(this, path, inx);
+    return WalkPath(path, inx);
+}
+
+void OMObject::InvalidatePathIndex()
+{
+    auto root = (OMObject*)MyRoot();
+    // handles too, though rebuilding the path index doesn't renumber them
+    root->InvalidateHandles();
+    auto index = root->GetPathIndex();
+    if (index)
+    {
+        flogw("tree changed after path index was built; falling back to tree walk");
+        index->Clear();
+    }
+}
+
+OMNode* OMObject::WalkPath(const String& path, int& inx)
 {
     // flogd("path: %s  inx: %d", path.c_str(), inx);
     if (inx >= path.length())
@@ -103,7 +195,7 @@ OMNode* OMObject::NodeFromPath(String path, int& inx)
     auto sub = GetObject(id);
     if (sub)
     {
-        auto n = sub->NodeFromPath(path, ++inx);
+        auto n = sub->WalkPath(path, ++inx);
         if (n)
             return n;
         return sub;
@@ -114,13 +206,13 @@ OMNode* OMObject::NodeFromPath(String path, int& inx)
     return p;
 }
 
-OMObject* OMObject::ObjectFromPath(String path)
+OMObject* OMObject::ObjectFromPath(const String& path)
 {
     int inx = 0;
     return (OMObject*)NodeFromPath(path, inx);
 }
 
-OMProperty* OMObject::PropertyFromPath(String path, char propertyID)
+OMProperty* OMObject::PropertyFromPath(const String& path, char propertyID)
 {
     auto obj = ObjectFromPath(path);
     if (!obj)
@@ -128,7 +220,10 @@ OMProperty* OMObject::PropertyFromPath(String path, char propertyID)
         floge("object not found for path: %s", path.c_str());
         return nullptr;
     }
-    auto prop = obj->GetProperty(propertyID);
+    auto index = ((OMObject*)MyRoot())->GetPathIndex();
+    auto node = index ? index->Find(obj, propertyID) : nullptr;
+    // an object sharing the Id shadows the property in the index
+    auto prop = node && !node->IsObject() ? (OMProperty*)node : obj->GetProperty(propertyID);
     if (!prop)
     {
         floge("property Id %c not found for object: %s", propertyID, obj->Name);
@@ -157,37 +252,66 @@ OMObject* OMObject::GetObject(char objectID)
     return nullptr;
 }
 
+void OMNode::Attached()
+{
+    // the parent's root and path are current, so this node's follow from them
+    Top = Parent->Top;
+    if (Parent->PathLen != OMNoPath && Parent->PathLen + 1 < OMPathMax)
+    {
+        memcpy(Path, Parent->Path, Parent->PathLen);
+        Path[Parent->PathLen] = Id;
+        PathLen = Parent->PathLen + 1;
+        Path[PathLen] = 0;
+    }
+    else
+        PathLen = OMNoPath;
+}
+
 void OMObject::AddProperty(OMProperty* p)
 {
     // flogv("adding property %s  type: %d", p->Name, p->GetType());
+    InvalidatePathIndex();
     Properties.push_back(p);
     p->Parent = this;
+    p->Attached();
     if (Connector)
         Connector->Pull(this, p);
 }
 
-void OMObject::AddProperties(const OMPropDef* def)
+void OMObject::AddProperties(const OMPropDef* def, OMPool* pool)
 {
+    // size the vector once rather than growing it a property at a time
+    size_t count = 0;
+    for (auto d = def; d && d->Id; ++d)
+        ++count;
+    Properties.reserve(Properties.size() + count);
     while (def && def->Id)
-        AddProperty(def++);
+        AddProperty(def++, pool);
 }
 
-void OMObject::AddProperty(const OMPropDef* def)
+void OMObject::AddProperty(const OMPropDef* def, OMPool* pool)
 {
     OMProperty* prop;
     switch (def->Type)
     {
     case OMT_BOOL:
-        prop = new OMPropertyBool(def->Id, def->Name);
+        prop = OMNew<OMPropertyBool>(pool, def->Id, def->Name);
         break;
     case OMT_LONG:
-        prop = new OMPropertyLong(def->Id, def->Name, def->Min, def->Max, def->Base);
+        {
+            auto lp = OMNew<OMPropertyLong>(pool, def->Id, def->Name, def->Min, def->Max, (uint8_t)def->Base);
+            if (def->Step > 1)
+                lp->Step = def->Step;
+            lp->Deadband = def->Deadband;
+            prop = lp;
+        }
         break;
     case OMT_CHAR:
-        prop = new OMPropertyChar(def->Id, def->Name, def->Valid);
+        prop = OMNew<OMPropertyChar>(pool, def->Id, def->Name, def->Valid);
         break;
     case OMT_STRING:
-        prop = new OMPropertyString(def->Id, def->Name);
+    default:
+        prop = OMNew<OMPropertyString>(pool, def->Id, def->Name);
         break;
     }
     prop->Flags = def->Flags;
@@ -196,49 +320,56 @@ void OMObject::AddProperty(const OMPropDef* def)
 
 void OMObject::AddObject(OMObject* o)
 {
+    InvalidatePathIndex();
     Objects.push_back(o);
     o->Parent = this;
+    // parents before children, so each node updates from an already updated parent
+    o->VisitNodes([](OMNode* n) { n->Attached(); return true; });
     // flogv("adding object %s : %s", o->Parent->Name, o->Name);
     if (o->Connector)
         o->Connector->Init(o);
 }
 
-void OMObject::AddObjects(const OMObjDef* def)
+void OMObject::AddObjects(const OMObjDef* def, OMPool* pool)
 {
+    size_t count = 0;
+    for (auto d = def; d && d->Id; ++d)
+        ++count;
+    Objects.reserve(Objects.size() + count);
     while (def && def->Id)
-        AddObject(def++);
+        AddObject(def++, pool);
 }
 
-void OMObject::AddObject(const OMObjDef* def)
+void OMObject::AddObject(const OMObjDef* def, OMPool* pool)
 {
-    auto obj = new OMObject(def->Id, def->Name, def->Connector);
+    auto obj = OMNew<OMObject>(pool, def->Id, def->Name, def->Connector);
     AddObject(obj);
-    obj->AddProperties(def->Properties);
-    obj->AddObjects(def->Objects);
+    obj->AddProperties(def->Properties, pool);
+    obj->AddObjects(def->Objects, pool);
+}
+
+const std::vector<OMProperty*>* OMObject::SubtreeHandles()
+{
+    // Root::Setup numbers properties in traversal order, so while the tree is unchanged
+    // since a subtree is a contiguous run of handles
+    if (FirstHandle == OMNoHandle)
+        return nullptr;
+    return ((OMObject*)MyRoot())->GetHandles();
 }
 
 void OMObject::TraverseNodes(EnumNodeFn fn)
 {
-    fn(this);
-    for (auto p : Properties)
-        fn(p);
-    for (auto o : Objects)
-        o->TraverseNodes(fn);
+    VisitNodes([fn](OMNode* n) { fn(n); return true; });
 }
 
 void OMObject::TraverseProperties(EnumPropFn fn)
 {
-    for (auto p : Properties)
-        fn(p);
-    for (auto o : Objects)
-        o->TraverseProperties(fn);
+    VisitProperties([fn](OMProperty* p) { fn(p); return true; });
 }
 
 void OMObject::TraverseObjects(EnumObjFn fn)
 {
-    fn(this);
-    for (auto o : Objects)
-        o->TraverseObjects(fn);
+    VisitObjects([fn](OMObject* o) { fn(o); return true; });
 }
 
 void OMObject::Dump()
@@ -252,19 +383,162 @@ void Root::Setup(Agent* pagent)
     if (IsDevice)
     {
         // traverse all properties to pull initial values
-        // and load preferences
-        TraverseProperties([](OMProperty *p) {
-            p->Pull();
-            p->LoadPref();
-        });
+        // then load preferences over them, opening the namespace just once
+        VisitProperties([](OMProperty* p) { p->Pull(); return true; });
+        OMPrefs().Load(this, true);
+        // values just loaded needn't be saved back
+        for (auto p : PersistProps)
+            p->PersistDirty = false;
+        PersistProps.clear();
     }
     else
     {
     }
+    Session = esp_random() | 1;
+    // the tree is complete once the application calls Setup
+    BuildPathIndex();
+    Handles.clear();
+    Signature = 2166136261u;
+    BuildHandles(this);
+    HandlesBuilt = true;
+}
+
+void Root::BuildHandles(OMObject* obj)
+{
+    // handles follow TraverseProperties order so both peers number identical trees identically
+    // and the FNV-1a signature over paths and types tells them whether they do
+    obj->FirstHandle = Handles.size();
+    for (auto p : obj->Properties)
+    {
+        p->Handle = Handles.size();
+        Handles.push_back(p);
+        auto path = p->GetPath();
+        for (int i = 0; i < path.length(); ++i)
+            Signature = (Signature ^ (uint8_t)path[i]) * 16777619u;
+        Signature = (Signature ^ (uint8_t)p->GetType()) * 16777619u;
+        if (p->Type == OMT_LONG)
+        {
+            // binary longs are steps above Min, so both ends need the same range and step
+            auto lp = static_cast<OMPropertyLong*>(p);
+            long range[] = { lp->Min, lp->Step };
+            for (size_t i = 0; i < sizeof(range); ++i)
+                Signature = (Signature ^ ((uint8_t*)range)[i]) * 16777619u;
+        }
+    }
+    for (auto o : obj->Objects)
+        BuildHandles(o);
+    obj->EndHandle = Handles.size();
 }
 
 void Root::Run()
 {
+    Service();
+}
+
+void Root::Service()
+{
+    if (!SettlingProps.empty() && millis() - SettlingMS >= SettleMS)
+        SettleProperties();
+    if (!ChangedProps.empty())
+        DispatchChanges();
+    if (!PersistProps.empty())
+    {
+        uint32_t now = millis();
+        if (now - PersistLastMS >= PersistQuietMS || now - PersistFirstMS >= PersistMaxMS)
+            FlushPersist();
+    }
+}
+
+void Root::Subscribe(OMNode* node, OMChangeFn fn, void* context)
+{
+    Subscriptions.push_back({ node, fn, context, false });
+}
+
+void Root::Unsubscribe(OMNode* node, OMChangeFn fn, void* context)
+{
+    for (auto& s : Subscriptions)
+    {
+        if (s.Node == node && s.Fn == fn && s.Context == context)
+            s.Fn = nullptr;
+    }
+    // removed now unless a dispatch is iterating them
+    if (!Dispatching)
+        Subscriptions.erase(std::remove_if(Subscriptions.begin(), Subscriptions.end(), [](const Subscription& s) { return !s.Fn; }), Subscriptions.end());
+}
+
+void Root::MarkChanged(OMProperty* p)
+{
+    if (Subscriptions.empty() || p->NotifyDirty)
+        return;
+    p->NotifyDirty = true;
+    ChangedProps.push_back(p);
+}
+
+void Root::DispatchChanges()
+{
+    // changes made by the callbacks are dispatched on the next Service
+    Notifying.swap(ChangedProps);
+    for (auto p : Notifying)
+    {
+        p->NotifyDirty = false;
+        // the property's own subscriptions and those of the objects above it
+        for (auto& s : Subscriptions)
+        {
+            if (s.Due)
+                continue;
+            for (OMNode* n = p; n; n = n->Parent)
+            {
+                if (n == s.Node)
+                {
+                    s.Due = true;
+                    break;
+                }
+            }
+        }
+    }
+    Notifying.clear();
+
+    Dispatching = true;
+    // by index: a callback may subscribe
+    for (size_t i = 0; i < Subscriptions.size(); ++i)
+    {
+        if (!Subscriptions[i].Due)
+            continue;
+        Subscriptions[i].Due = false;
+        auto s = Subscriptions[i];
+        if (s.Fn)
+            s.Fn(s.Node, s.Context);
+    }
+    Dispatching = false;
+    Subscriptions.erase(std::remove_if(Subscriptions.begin(), Subscriptions.end(), [](const Subscription& s) { return !s.Fn; }), Subscriptions.end());
+}
+
+void Root::MarkPersist(OMProperty* p)
+{
+    PersistLastMS = millis();
+    if (p->PersistDirty)
+        return;
+    if (PersistProps.empty())
+        PersistFirstMS = PersistLastMS;
+    p->PersistDirty = true;
+    PersistProps.push_back(p);
+}
+
+void Root::FlushPersist()
+{
+    // grouped by object so each object's blob is read and written once
+    std::sort(PersistProps.begin(), PersistProps.end(), [](OMProperty* a, OMProperty* b) { return a->Parent < b->Parent; });
+    {
+        OMPrefs prefs;
+        for (auto p : PersistProps)
+        {
+            p->PersistDirty = false;
+            prefs.Save(p);
+        }
+    }
+    flogv("autosave: %u properties", PersistProps.size());
+    PersistProps.clear();
+    ++AutoSaves;
 }
 
 void Root::Command(String cmd)
@@ -276,6 +550,37 @@ void Root::Command(String cmd)
         return;
     }
     char operation = cmd[inx++];
+    if (operation == '#' || operation == '$')
+    {
+        // binary command negotiation
+        //  '#' controller's offer of its tree signature, 0 for text only; always answered
+        //  '$' device's answer with its own, never answered
+        // each side uses binary commands once it has seen a signature matching its own
+        uint32_t signature = strtoul(cmd.c_str() + inx, nullptr, 16);
+        BinaryPeer = BinaryWire && signature != 0 && signature == Signature;
+        if (BinaryWire && signature != 0 && !BinaryPeer)
+            flogw("peer tree signature mismatch; using text commands");
+        if (operation == '#')
+            SendCmd(String('$') + String((unsigned long)(BinaryWire ? Signature : 0), 16));
+        return;
+    }
+    if (operation == '@')
+    {
+        // @session.generation
+        // to the device: resync request from the generation the controller last saw
+        // to the controller: the device's properties up to this generation have been sent
+        char* pend;
+        uint32_t session = strtoul(cmd.c_str() + inx, &pend, 16);
+        uint32_t generation = *pend == '.' ? strtoul(pend + 1, nullptr, 16) : 0;
+        if (IsDevice)
+            Resync(session, generation);
+        else
+        {
+            PeerSession = session;
+            PeerGeneration = generation;
+        }
+        return;
+    }
     bool rooted = false;
     if (inx < cmd.length() && cmd[inx] == Id)
     {
@@ -306,41 +611,43 @@ void Root::Command(String cmd)
             auto v = cmd.substring(inx);
             flogv("assign %s to %s.%s", v.c_str(), p->Parent->Name, p->Name);
             p->FromString(v);
+            Received(p);
         }
         break;
     case '?':
+        // an explicit request is answered even for a change within the deadband
         if (node->IsObject())
-            ((OMObject*)node)->TraverseProperties([](OMProperty* p) { p->Send(); });
-        else
-            ((OMProperty*)node)->Send();
+            ((OMObject*)node)->VisitProperties([this](OMProperty* p) { if (p->IsSent()) SendProperty(p, true); return true; }, OMFilter(-1, 0, OMF_LOCAL));
+        else if (((OMProperty*)node)->IsSent())
+            SendProperty((OMProperty*)node, true);
         break;
     case '*':
         if (node->IsObject())
-            ((OMObject*)node)->TraverseNodes([](OMNode* n) { n->Dump(); });
+            ((OMObject*)node)->VisitNodes([](OMNode* n) { n->Dump(); return true; });
         else
             node->Dump();
         break;
     case '>':
         if (node->IsObject())
-            ((OMObject*)node)->TraverseProperties([](OMProperty* p) { p->SavePref(); });
+            OMPrefs().Save((OMObject*)node, true);
         else
             ((OMProperty*)node)->SavePref();
         break;
     case '<':
         if (node->IsObject())
-            ((OMObject*)node)->TraverseProperties([](OMProperty* p) { p->LoadPref(); });
+            OMPrefs().Load((OMObject*)node, true);
         else
             ((OMProperty*)node)->LoadPref();
         break;
     case '!':
         if (node->IsObject())
-            ((OMObject*)node)->TraverseProperties([](OMProperty* p) { p->DumpPref(); });
+            OMPrefs().Dump((OMObject*)node, true);
         else
             ((OMProperty*)node)->DumpPref();
         break;
     case '-':
         if (node->IsObject())
-            ((OMObject*)node)->TraverseProperties([](OMProperty* p) { p->RemovePref(); });
+            OMPrefs().Remove((OMObject*)node, true);
         else
             ((OMProperty*)node)->RemovePref();
         break;
@@ -352,28 +659,259 @@ void Root::Command(String cmd)
 
 void Root::SendCmd(String cmd) { pAgent->SendCmd(cmd); }
 
-void Root::ConnectionChanged(bool connected)
+void Root::SendProperty(OMProperty* p, bool force)
 {
-    if (connected)
+    p->Version = ++Generation;
+    if (!force && p->Type == OMT_LONG && static_cast<OMPropertyLong*>(p)->InDeadband() && !p->Dirty)
     {
-        if (IsDevice)
+        // too small a change to send on its own; sent if it is where things settle
+        ++DeadbandHeld;
+        SettlingMS = millis();
+        if (!p->Settling)
         {
+            p->Settling = true;
+            SettlingProps.push_back(p);
+        }
+        return;
+    }
+    QueueProperty(p);
+}
 
+void Root::SettleProperties()
+{
+    for (auto p : SettlingProps)
+    {
+        p->Settling = false;
+        if (static_cast<OMPropertyLong*>(p)->Value != static_cast<OMPropertyLong*>(p)->LastSent)
+            QueueProperty(p);
+    }
+    SettlingProps.clear();
+}
+
+void Root::QueueProperty(OMProperty* p)
+{
+    // coalesce: only mark the property; its value is read when the next frame is built
+    // so repeated changes between frames cost a single command
+    if (p->Dirty)
+    {
+        ++Coalesced;
+        return;
+    }
+    p->Dirty = true;
+    DirtyProps.push_back(p);
+}
+
+uint16_t Root::FlushProperties(uint16_t budget)
+{
+    // queue the latest values of pending properties, up to about budget bytes of output
+    uint16_t used = 0;
+    // called with the agent's queues drained: the values a pending mark covers are in earlier frames
+    if (MarkPending)
+    {
+        used += SendMark();
+    }
+    while (DirtyHead < DirtyProps.size() && used < budget)
+    {
+        auto p = DirtyProps[DirtyHead++];
+        p->Dirty = false;
+        if (p->Type == OMT_LONG)
+            static_cast<OMPropertyLong*>(p)->LastSent = static_cast<OMPropertyLong*>(p)->Value;
+        OMRecord rec;
+        if (BinaryPeer && EncodeRecord(p, rec))
+        {
+            pAgent->SendRecord(rec);
+            used += rec.Len + 1;
         }
         else
         {
-            SendCmd("?R");  // request ALL current property values
+            // built in place: no String for the path or the command
+            uint8_t cmd[1 + OMPathMax + OMRecordMax];
+            auto path = p->PathChars();
+            auto value = p->ToString();
+            uint16_t len = 0;
+            cmd[len++] = '=';
+            if (path && 1 + strlen(path) + value.length() <= sizeof(cmd))
+            {
+                len += strlen(path);
+                memcpy(cmd + 1, path, len - 1);
+                memcpy(cmd + len, value.c_str(), value.length());
+                len += value.length();
+                pAgent->SendCmd(cmd, len);
+            }
+            else
+            {
+                auto s = String('=') + p->GetPath() + value;
+                SendCmd(s);
+                len = s.length();
+            }
+            used += len + 1;
         }
     }
-    else
+    if (DirtyHead == DirtyProps.size())
     {
-        if (IsDevice)
+        // keeps capacity so steady state sends don't allocate
+        DirtyProps.clear();
+        DirtyHead = 0;
+    }
+    else if (DirtyHead >= 64)
+    {
+        // never fully drained under sustained changes; drop the sent prefix
+        DirtyProps.erase(DirtyProps.begin(), DirtyProps.begin() + DirtyHead);
+        DirtyHead = 0;
+    }
+    // everything up to Generation is queued: let the controller know once it has gone out
+    // the agent sends text before records, so a mark queued now could overtake the values
+    if (IsDevice && DirtyHead == DirtyProps.size() && (MarkDue || (Generation != MarkedGeneration && millis() - MarkedMS >= MarkMS)))
+    {
+        MarkedGeneration = Generation;
+        MarkedMS = millis();
+        MarkDue = false;
+        MarkPending = true;
+        if (used == 0)
         {
+            used += SendMark();
+        }
+    }
+    return used;
+}
+
+uint16_t Root::SendMark()
+{
+    auto cmd = String('@') + String((unsigned long)Session, 16) + '.' + String((unsigned long)MarkedGeneration, 16);
+    SendCmd(cmd);
+    MarkPending = false;
+    return cmd.length() + 1;
+}
+
+void Root::FramesDropped(bool lost)
+{
+    if (IsDevice)
+    {
+        // a later mark would cover values the controller never got
+        FullResyncDue = true;
+        return;
+    }
+    // the marked generation can't be trusted: resync everything, now if the device is still sending
+    PeerSession = 0;
+    PeerGeneration = 0;
+    if (lost)
+        SendCmd("@0.0");
+}
 
+void Root::Resync(uint32_t session, uint32_t generation)
+{
+    // send only what changed since the controller's generation; everything if that
+    // generation is from another boot (or none), or from the future
+    bool full = FullResyncDue || session != Session || generation > Generation;
+    FullResyncDue = false;
+    if (full)
+        ++FullResyncs;
+    else
+        ++Resyncs;
+    flogi("%s resync from generation %lu to %lu", full ? "full" : "incremental", full ? 0 : generation, Generation);
+    for (auto p : Handles)
+    {
+        if (p->IsSent() && (full || p->Version > generation))
+            QueueProperty(p);
+    }
+    // mark even an empty resync, once its values are queued
+    MarkDue = true;
+}
+
+bool Root::EncodeRecord(OMProperty* p, OMRecord& rec)
+{
+    if (p->Handle == OMNoHandle)
+        return false;
+    uint8_t len = OMPutVarint(rec.Data, p->Handle);
+    switch (p->GetType())
+    {
+    case OMT_LONG:
+        len += OMPutVarint(rec.Data + len, static_cast<OMPropertyLong*>(p)->ToSteps());
+        break;
+    case OMT_BOOL:
+        rec.Data[len++] = p->As<bool>()->Value ? 1 : 0;
+        break;
+    case OMT_CHAR:
+        rec.Data[len++] = p->As<char>()->Value;
+        break;
+    case OMT_STRING:
+        {
+            auto& v = p->As<String>()->Value;
+            if (len + v.length() > OMRecordMax)
+                return false;
+            memcpy(rec.Data + len, v.c_str(), v.length());
+            len += v.length();
         }
-        else
+        break;
+    }
+    rec.Len = len;
+    return true;
+}
+
+void Root::Command(const OMRecord& rec)
+{
+    uint32_t handle;
+    auto n = OMGetVarint(rec.Data, rec.Len, handle);
+    if (n == 0 || handle >= Handles.size())
+    {
+        floge("invalid property handle");
+        return;
+    }
+    auto p = Handles[handle];
+    auto data = rec.Data + n;
+    uint8_t len = rec.Len - n;
+    switch (p->GetType())
+    {
+    case OMT_LONG:
         {
-            
+            uint32_t v;
+            if (OMGetVarint(data, len, v) == 0)
+            {
+                floge("invalid long value for %s.%s", p->Parent->Name, p->Name);
+                return;
+            }
+            static_cast<OMPropertyLong*>(p)->Set(static_cast<OMPropertyLong*>(p)->FromSteps(v));
         }
+        break;
+    case OMT_BOOL:
+        if (len > 0)
+            p->As<bool>()->Set(data[0] != 0);
+        break;
+    case OMT_CHAR:
+        if (len > 0)
+            p->As<char>()->Set((char)data[0]);
+        break;
+    case OMT_STRING:
+        p->As<String>()->Set(String(data, len));
+        break;
+    }
+    Received(p);
+}
+
+// the peer now has the value it sent, so the deadband is measured from it
+void Root::Received(OMProperty* p)
+{
+    if (p->Type == OMT_LONG)
+    {
+        auto pl = static_cast<OMPropertyLong*>(p);
+        pl->LastSent = pl->Value;
+    }
+}
+
+void Root::ConnectionChanged(bool connected)
+{
+    if (IsDevice)
+        return;     // binary stays as negotiated until the controller's next offer
+    if (connected)
+    {
+        // offer binary (or tell the device to stop using it) on every connection
+        SendCmd(String('#') + String((unsigned long)(BinaryWire ? Signature : 0), 16));
+        // request the property values changed since the device's last mark
+        SendCmd(String('@') + String((unsigned long)PeerSession, 16) + '.' + String((unsigned long)PeerGeneration, 16));
+    }
+    else
+    {
+        // renegotiate on the next connection
+        BinaryPeer = false;
     }
 }
@@ -2,25 +2,40 @@
 
 #include <Arduino.h>
 #include <vector>
+#include <new>
 #include "FLogger.h"
+#include "OMBinary.h"
+
+// longest path cached in a node, plus its terminator; deeper nodes build theirs on each call
+const uint8_t OMPathMax = 8;
+const uint8_t OMNoPath = 0xFF;
 
 class OMNode
 {
 public:
-    OMNode(char id, const char* name) : Id(id), Name(name) {}
-    OMNode*             Parent;
+    OMNode(char id, const char* name) : Id(id), Name(name) { Path[0] = 0; }
+    OMNode*             Parent = nullptr;
     virtual bool        IsObject() = 0;
     String              GetPath()
     {
-        if (Parent)
-            return Parent->GetPath() + Id;
-        return "";
+        if (PathLen != OMNoPath)
+            return String(Path);
+        return Parent->GetPath() + Id;
     }
+    // the cached path without building a String; nullptr if too deep to cache
+    const char*         PathChars() { return PathLen != OMNoPath ? Path : nullptr; }
     virtual void        Dump() = 0;
-    OMNode*             MyRoot() { return Parent ? Parent->MyRoot() : this; }
+    OMNode*             MyRoot() { return Top; }
     char                Id;
     const char*         Name;
     void*               Data = nullptr;
+protected:
+    // cached from the parent when the node (or an object above it) is attached to the tree
+    OMNode*             Top = this;
+    uint8_t             PathLen = 0;
+    char                Path[OMPathMax];
+    void                Attached();
+    friend class OMObject;
 };
 
 class OMObject;
@@ -40,6 +55,7 @@ enum OMF
     OMF_LOCAL     = 0b0001,     // do not send to peer
     OMF_RO_DEVICE = 0b0010,     // no read only from device
     OMF_WO_DEVICE = 0b0100,     // no write only to device
+    OMF_PERSIST   = 0b1000,     // saved to preferences automatically, shortly after it changes
 };
 
 class OMConnector
@@ -60,6 +76,9 @@ struct OMPropDef
     long        Max;
     long        Base;
     const char* Valid;  // valid chars for OMT_CHAR
+    // OMT_LONG only, both optional
+    long        Step;       // resolution: values are rounded to Min + a multiple of Step
+    long        Deadband;   // changes smaller than this from the last value sent wait to settle
 };
 
 struct OMObjDef
@@ -71,36 +90,114 @@ struct OMObjDef
     OMConnector* Connector;
 };
 
+// bump allocator for nodes built from OMObjDef/OMPropDef tables
+// places the whole tree in one block allocated at link time (see OMStaticPool)
+// so boot doesn't fragment the heap; falls back to the heap if the block is too small
+class OMPool
+{
+public:
+    OMPool(uint8_t* buffer, size_t size) : Buffer(buffer), Size(size) {}
+    void*               Alloc(size_t bytes);
+    size_t              Used = 0;
+    size_t              Overflow = 0;   // bytes that didn't fit and came from the heap
+    static constexpr size_t Align(size_t bytes) { return (bytes + sizeof(void*) - 1) & ~(sizeof(void*) - 1); }
+private:
+    uint8_t*            Buffer;
+    size_t              Size;
+};
+
+template <size_t N> class OMStaticPool : public OMPool
+{
+public:
+    OMStaticPool() : OMPool(Block, N) {}
+private:
+    alignas(void*) uint8_t Block[N];
+};
+
+// flat open-addressed hash of (parent, id) -> child node
+// built once over the whole tree so path resolution costs one probe per path character
+// instead of a linear scan of the Objects and Properties vectors at every level
+class OMPathIndex
+{
+public:
+    void                Build(OMObject* root);
+    void                Clear() { Slots.clear(); Count = 0; }
+    bool                IsBuilt() { return !Slots.empty(); }
+    OMNode*             Find(OMNode* parent, char id);
+    OMNode*             Resolve(OMObject* start, const String& path, int& inx);
+private:
+    struct Slot
+    {
+        OMNode*     Parent;
+        OMNode*     Node;
+        char        Id;
+    };
+    std::vector<Slot>   Slots;
+    uint16_t            Count = 0;
+    // multiplicative mix: nodes are allocated at a fixed stride, which a plain parent * 31 + id
+    // maps to overlapping runs of slots
+    uint32_t            Hash(OMNode* parent, char id)
+    {
+        uint32_t h = (uint32_t)((uintptr_t)parent >> 3) * 0x9E3779B1u + (uint8_t)id * 0x85EBCA77u;
+        return (h ^ (h >> 16)) & (Slots.size() - 1);
+    }
+    void                Insert(OMNode* parent, char id, OMNode* node);
+    void                Add(OMObject* obj);
+};
+
+template <typename T> class OMPropertyType;
+
+// the OMT of a property value type, for OMProperty::As
+template <typename T> struct OMTypeOf;
+template <> struct OMTypeOf<long>   { static const OMT Type = OMT_LONG; };
+template <> struct OMTypeOf<bool>   { static const OMT Type = OMT_BOOL; };
+template <> struct OMTypeOf<char>   { static const OMT Type = OMT_CHAR; };
+template <> struct OMTypeOf<String> { static const OMT Type = OMT_STRING; };
+
 class OMProperty : public OMNode
 {
 public:
-    OMProperty(char id, const char* name) : OMNode(id, name) {}
+    OMProperty(char id, const char* name, OMT type) : OMNode(id, name), Type(type) {}
+    const OMT           Type;                   // fixed by the subclass, so no virtual call to ask
     OMF                 Flags;
+    uint16_t            Handle = OMNoHandle;    // index for binary commands; assigned by Root::Setup
+    bool                Dirty = false;          // queued in Root's coalescing send stage
+    bool                PersistDirty = false;   // queued in Root's autosave stage
+    bool                NotifyDirty = false;    // queued for Root's change notifications
+    bool                Settling = false;       // change held back by a deadband
+    uint32_t            Version = 0;            // Root generation of the last change sent; 0 if never
         
     bool                IsObject() override { return false; }
     void                Dump() override;
-    virtual OMT         GetType() = 0;
+    OMT                 GetType() { return Type; }
+    // the typed property, checked rather than cast; nullptr if it holds another type
+    //      prop->As<long>()->Value
+    template <typename T> OMPropertyType<T>* As() { return Type == OMTypeOf<T>::Type ? static_cast<OMPropertyType<T>*>(this) : nullptr; }
     virtual String      ToString() = 0;
     virtual void        FromString(String s) = 0;
     void                Pull();
     void                Push();
     void                Send();
+    bool                IsSent();               // goes to the peer rather than staying local
     void                PullSend() { Pull(); Send(); }
+    bool                IsPersisted();          // saved to and loaded from preferences
     void                SavePref();
     void                LoadPref();
     void                DumpPref();
     void                RemovePref();
+    void                Changed();              // value set; notifies subscribers, autosaves an OMF_PERSIST property
 };
 
 template <typename T> class OMPropertyType : public OMProperty
 {
 public:
-    OMPropertyType(char id, const char* name) : OMProperty(id, name), Value(T()) {}
+    OMPropertyType(char id, const char* name) : OMProperty(id, name, OMTypeOf<T>::Type), Value(T()) {}
     T Value;
         
     T Get() { return Value; }
     virtual void Set(T value)
     {
+        value = Quantize(value);
         if (!Test(value))
         {
             floge("invalid value");
@@ -110,11 +207,29 @@ public:
             return;
         Value = value;
         Push();
+        Changed();
     }
-    void SetSend(T value) { Value = value; Send(); }
+    void SetSend(T value) { Value = Quantize(value); Send(); }
     virtual bool Test(T value) = 0;
+    // the value the property can hold nearest to value; both Set and SetSend apply it
+    virtual T Quantize(T value) { return value; }
 };
 
+// property filter for the Visit traversals: of Type (or any, if -1),
+// with all of the FlagsAll flags and none of the FlagsNone flags
+struct OMFilter
+{
+    OMFilter(int type = -1, int flagsAll = 0, int flagsNone = 0) : Type(type), FlagsAll(flagsAll), FlagsNone(flagsNone) {}
+    int     Type;
+    int     FlagsAll;
+    int     FlagsNone;
+    bool    All() const { return Type < 0 && FlagsAll == 0 && FlagsNone == 0; }
+    bool    Match(OMProperty* p) const { return (Type < 0 || p->Type == Type) && (p->Flags & FlagsAll) == FlagsAll && (p->Flags & FlagsNone) == 0; }
+};
+
+// depth of the Visit walkers' explicit stacks; deeper subtrees get a walker of their own
+const int OMVisitDepth = 8;
+
 class OMObject : public OMNode
 {
 public:
@@ -122,8 +237,14 @@ public:
     bool                IsObject() override { return true; }
     OMProperty*         GetProperty(char propertyID);
     OMObject*           GetObject(char objectID);
-    OMObject*           ObjectFromPath(String path);
-    OMProperty*         PropertyFromPath(String path, char propertyID);
+    OMObject*           ObjectFromPath(const String& path);
+    OMProperty*         PropertyFromPath(const String& path, char propertyID);
+    // visit the subtree with any callable returning bool; return false to stop early
+    // the walks are iterative, in the order the Traverse functions use; they return false if stopped
+    //      root.VisitProperties([&](OMProperty* p) { total += p->As<long>()->Value; return true; }, OMFilter(OMT_LONG));
+    template <typename Fn> bool VisitNodes(Fn fn);
+    template <typename Fn> bool VisitProperties(Fn fn, const OMFilter& filter = OMFilter());
+    template <typename Fn> bool VisitObjects(Fn fn);
     using EnumNodeFn = void (*)(OMNode* p);
     void                TraverseNodes(EnumNodeFn fn);
     using EnumPropFn = void (*)(OMProperty* p);
@@ -131,32 +252,132 @@ public:
     using EnumObjFn = void (*)(OMObject* p);
     void                TraverseObjects(EnumObjFn fn);
     void                Dump();
-    void                AddObjects(const OMObjDef* def);
-    void                AddObject(const OMObjDef* def);
-    void                AddProperties(const OMPropDef* def);
-    void                AddProperty(const OMPropDef* def);
+    void                AddObjects(const OMObjDef* def, OMPool* pool = nullptr);
+    void                AddObject(const OMObjDef* def, OMPool* pool = nullptr);
+    void                AddProperties(const OMPropDef* def, OMPool* pool = nullptr);
+    void                AddProperty(const OMPropDef* def, OMPool* pool = nullptr);
     void                AddObject(OMObject* o);
     void                AddProperty(OMProperty* p);
 
     OMConnector*        Connector = nullptr;
     std::vector<OMProperty*> Properties;
     std::vector<OMObject*> Objects;
+    virtual OMPathIndex* GetPathIndex() { return nullptr; }
 protected:
-    OMNode*             NodeFromPath(String path, int& inx);
+    // this object's subtree as a run of Root's property handles; see TraverseProperties
+    uint16_t            FirstHandle = OMNoHandle;
+    uint16_t            EndHandle = OMNoHandle;
+    virtual const std::vector<OMProperty*>* GetHandles() { return nullptr; }   // nullptr unless current
+    virtual void        InvalidateHandles() { }
+    const std::vector<OMProperty*>* SubtreeHandles();
+    friend class Root;
+    OMNode*             NodeFromPath(const String& path, int& inx);
+    OMNode*             WalkPath(const String& path, int& inx);
+    void                InvalidatePathIndex();
 };
 
+template <typename Fn> bool OMObject::VisitObjects(Fn fn)
+{
+    // preorder, with a stack of (object, next child) in place of recursion
+    struct Level
+    {
+        OMObject*   Obj;
+        size_t      Next;
+    };
+    Level stack[OMVisitDepth];
+    if (!fn(this))
+        return false;
+    int depth = 0;
+    stack[0] = { this, 0 };
+    while (depth >= 0)
+    {
+        auto& top = stack[depth];
+        if (top.Next >= top.Obj->Objects.size())
+        {
+            --depth;
+            continue;
+        }
+        auto o = top.Obj->Objects[top.Next++];
+        if (depth + 1 == OMVisitDepth)
+        {
+            if (!o->VisitObjects(fn))
+                return false;
+            continue;
+        }
+        if (!fn(o))
+            return false;
+        stack[++depth] = { o, 0 };
+    }
+    return true;
+}
+
+template <typename Fn> bool OMObject::VisitNodes(Fn fn)
+{
+    return VisitObjects([&fn](OMObject* o) {
+        if (!fn(o))
+            return false;
+        for (auto p : o->Properties)
+        {
+            if (!fn(p))
+                return false;
+        }
+        return true;
+    });
+}
+
+template <typename Fn> bool OMObject::VisitProperties(Fn fn, const OMFilter& filter)
+{
+    bool all = filter.All();
+    auto handles = SubtreeHandles();
+    if (handles)
+    {
+        auto props = handles->data();
+        for (uint16_t h = FirstHandle; h < EndHandle; ++h)
+        {
+            if ((all || filter.Match(props[h])) && !fn(props[h]))
+                return false;
+        }
+        return true;
+    }
+    return VisitObjects([&fn, &filter, all](OMObject* o) {
+        for (auto p : o->Properties)
+        {
+            if ((all || filter.Match(p)) && !fn(p))
+                return false;
+        }
+        return true;
+    });
+}
+
 class OMPropertyLong : public OMPropertyType<long>
 {
 public:
     OMPropertyLong(char id, const char* name, long min, long max, uint8_t base) : OMPropertyType<long>(id, name), Min(min), Max(max), Base(base == 0 ? 10 : 16) {}
 
-    OMT GetType() override { return OMT_LONG; }
+    // rounded to the nearest step, staying within Max
+    long Quantize(long value) override
+    {
+        if (Step > 1 && value >= Min)
+        {
+            value = Min + (value - Min + Step / 2) / Step * Step;
+            if (value > Max)
+                value -= Step;
+        }
+        return value;
+    }
 
     bool Test(long value) override
     {
         return value >= Min && value <= Max;
     }
 
+    // whether a change is too small to send yet
+    bool InDeadband() { return Deadband > 0 && labs(Value - LastSent) < Deadband; }
+    // the value as sent in binary records: steps above Min, so a narrow or coarse range takes fewer bytes
+    // quantized the same way, so binary and text carry the same value
+    uint32_t ToSteps() { long v = Quantize(Value); return v > Min ? (uint32_t)(v - Min) / (uint32_t)(Step > 1 ? Step : 1) : 0; }
+    long FromSteps(uint32_t steps) { return Min + (long)steps * (Step > 1 ? Step : 1); }
+
     String ToString() override
     {
         return String(Get(), Base);
@@ -169,6 +390,9 @@ public:
     }
     long Min;
     long Max;
+    long Step = 1;
+    long Deadband = 0;
+    long LastSent = 0;      // by Root's send stage
 private:
     uint8_t Base;
 };
@@ -178,8 +402,6 @@ class OMPropertyBool : public OMPropertyType<bool>  // Updated to inherit from O
 public:
     OMPropertyBool(char id, const char* name) : OMPropertyType<bool>(id, name) {}
 
-    OMT GetType() override { return OMT_BOOL; }
-
     String ToString() override
     {
         return String(Value ? '1' : '0');
@@ -216,8 +438,6 @@ class OMPropertyChar : public OMPropertyType<char>
 public:
     OMPropertyChar(char id, const char* name, const char* valid) : OMPropertyType<char>(id, name), Valid(valid) {}
 
-    OMT GetType() override { return OMT_CHAR; }
-
     String ToString() override
     {
         return String(Value);
@@ -264,8 +484,6 @@ class OMPropertyString : public OMPropertyType<String>
 public:
     OMPropertyString(char id, const char* name) : OMPropertyType<String>(id, name) {}
 
-    OMT GetType() override { return OMT_STRING; }
-
     String ToString() override
     {
         return String(Value);
@@ -282,20 +500,121 @@ public:
     }
 };
 
+// sizes of the nodes built from definition tables
+// constexpr so an OMStaticPool can be sized at compile time from constexpr tables:
+//      static OMStaticPool<OMObjDefBytes(Objects) + OMPropDefBytes(RootProps)> pool;
+//      root.AddObjects(Objects, &pool);
+constexpr size_t OMPropBytes(OMT type)
+{
+    return OMPool::Align(type == OMT_LONG ? sizeof(OMPropertyLong) :
+                         type == OMT_BOOL ? sizeof(OMPropertyBool) :
+                         type == OMT_CHAR ? sizeof(OMPropertyChar) :
+                                            sizeof(OMPropertyString));
+}
+
+constexpr size_t OMPropDefBytes(const OMPropDef* def)
+{
+    return def && def->Id ? OMPropBytes(def->Type) + OMPropDefBytes(def + 1) : 0;
+}
+
+constexpr size_t OMObjDefBytes(const OMObjDef* def)
+{
+    return def && def->Id ? OMPool::Align(sizeof(OMObject)) + OMPropDefBytes(def->Properties) + OMObjDefBytes(def->Objects) + OMObjDefBytes(def + 1) : 0;
+}
+
 class Agent;
 
+// change notification; node is the property or object subscribed to
+using OMChangeFn = void (*)(OMNode* node, void* context);
+
 class Root : public OMObject
 {
 public:
 	Root(bool isDevice, char id, const char* name, OMConnector* connector = nullptr) : OMObject(id, name, connector), IsDevice(isDevice) { }
 	virtual void	Setup(Agent* pagent);
 	virtual void	Run();
+	// settling, change dispatch and autosave; the agent calls it from every Run of its own,
+	// so they happen whether or not an application's Run calls Root::Run
+	void			Service();
     virtual void    Command(String cmd);    // UNDONE: virtual temporary?
+    void            Command(const OMRecord& rec);
     void            SendCmd(String cmd);
+    void            SendProperty(OMProperty* p, bool force = false);    // force: bypass the deadband
+    uint16_t        FlushProperties(uint16_t budget);
+    uint32_t        Coalesced = 0;          // property sends absorbed by an already pending send
+    // device: bumped by every property sent; the controller resyncs from the last generation it saw
+    uint32_t        Generation = 0;
+    uint32_t        Session = 0;            // device boot, so generations from a previous boot aren't trusted
+    uint32_t        Resyncs = 0;            // incremental resyncs served
+    uint32_t        FullResyncs = 0;
+    // autosave: OMF_PERSIST properties are saved together once changes have been quiet for
+    // PersistQuietMS, or PersistMaxMS after the first change if they keep coming
+    void            MarkPersist(OMProperty* p);
+    void            FlushPersist();
+    uint32_t        PersistQuietMS = 2000;
+    uint32_t        PersistMaxMS = 30000;
+    uint32_t        AutoSaves = 0;
+    // sends of properties with a deadband: held back, and sent once changes settle for SettleMS
+    uint32_t        SettleMS = 200;
+    uint32_t        DeadbandHeld = 0;
+    // change subscriptions: fn is called from Service after node changes, once per Service however
+    // often it changed; subscribed to an object, after any property in its subtree changes
+    // may be called from a callback; an unsubscribed callback isn't called again
+    void            Subscribe(OMNode* node, OMChangeFn fn, void* context = nullptr);
+    void            Unsubscribe(OMNode* node, OMChangeFn fn, void* context = nullptr);
+    void            MarkChanged(OMProperty* p);
+    // the agent abandoned frames (sent) or the peer skipped frames we never got (lost)
+    void            FramesDropped(bool lost);
     virtual void    ReceivedFile(String fileName) {}
     Agent*          GetAgent() { return pAgent; }
     virtual void    ConnectionChanged(bool connected);
+    void            BuildPathIndex() { PathIndex.Build(this); }
+    OMPathIndex*    GetPathIndex() override { return PathIndex.IsBuilt() ? &PathIndex : nullptr; }
+    const std::vector<OMProperty*>* GetHandles() override { return HandlesBuilt ? &Handles : nullptr; }
     bool            IsDevice = false;
+    bool            BinaryWire = false;     // offer binary commands to a peer with a matching tree
+    bool            BinaryPeer = false;     // peer has agreed to binary commands
+    uint32_t        Signature = 0;          // hash of the tree layout the property handles depend on
 private:
-    Agent*          pAgent;
+    Agent*          pAgent = nullptr;
+    OMPathIndex     PathIndex;
+    std::vector<OMProperty*> Handles;
+    bool            HandlesBuilt = false;   // by Setup, and the tree unchanged since
+    void            InvalidateHandles() override { HandlesBuilt = false; }
+    std::vector<OMProperty*> DirtyProps;    // pending sends in order of first change
+    size_t          DirtyHead = 0;
+    void            QueueProperty(OMProperty* p);
+    void            Received(OMProperty* p);
+    std::vector<OMProperty*> PersistProps;  // changed since the last autosave
+    uint32_t        PersistFirstMS = 0;
+    uint32_t        PersistLastMS = 0;
+    struct Subscription
+    {
+        OMNode*     Node;
+        OMChangeFn  Fn;             // nullptr once unsubscribed, until removed after dispatch
+        void*       Context;
+        bool        Due;
+    };
+    std::vector<OMProperty*> SettlingProps;
+    uint32_t        SettlingMS = 0;
+    void            SettleProperties();
+    std::vector<Subscription> Subscriptions;
+    std::vector<OMProperty*> ChangedProps;  // changed since the last dispatch
+    std::vector<OMProperty*> Notifying;     // being dispatched; kept for its capacity
+    bool            Dispatching = false;
+    void            DispatchChanges();
+    // device: generation the controller has been told it holds, and when
+    static const uint32_t MarkMS = 1000;    // at most this often while properties keep changing
+    uint32_t        MarkedGeneration = 0;
+    uint32_t        MarkedMS = 0;
+    bool            MarkDue = false;        // mark at the next drain regardless
+    bool            MarkPending = false;    // MarkedGeneration to send once its values have gone out
+    bool            FullResyncDue = false;  // frames were abandoned: the next resync is full
+    uint16_t        SendMark();
+    void            Resync(uint32_t session, uint32_t generation);
+    // controller: device session and generation last marked
+    uint32_t        PeerSession = 0;
+    uint32_t        PeerGeneration = 0;
+    void            BuildHandles(OMObject* obj);
+    bool            EncodeRecord(OMProperty* p, OMRecord& rec);
 };
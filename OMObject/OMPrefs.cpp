@@ -0,0 +1,250 @@
+#include "OMPrefs.h"
+
+extern const char* OMPrefNamespace;
+
+uint32_t OMPrefs::Writes = 0;
+uint32_t OMPrefs::Unchanged = 0;
+
+OMPrefs::OMPrefs()
+{
+    Open = Prefs.begin(OMPrefNamespace, false);
+    if (!Open)
+        floge("preferences open error");
+}
+
+OMPrefs::~OMPrefs()
+{
+    Write();
+    if (Open)
+        Prefs.end();
+}
+
+void OMPrefs::Read(OMObject* obj)
+{
+    if (obj == Current)
+        return;
+    Write();
+    Current = obj;
+    Stored.clear();
+    Blob.clear();
+    Legacy = false;
+    if (!Open)
+        return;
+    auto key = String('@') + obj->GetPath();
+    size_t len = Prefs.isKey(key.c_str()) ? Prefs.getBytesLength(key.c_str()) : 0;
+    if (len > 0)
+    {
+        Stored.resize(len);
+        Prefs.getBytes(key.c_str(), Stored.data(), len);
+    }
+    else
+    {
+        // saved before blobs: gather the per property keys
+        for (auto p : obj->Properties)
+        {
+            auto path = p->GetPath();
+            if (!Prefs.isKey(path.c_str()))
+                continue;
+            Append(Stored, p->Id, Prefs.getString(path.c_str()));
+            Legacy = true;
+        }
+    }
+    Blob = Stored;
+}
+
+void OMPrefs::Write()
+{
+    if (!Open || !Current || !Pending)
+        return;
+    Pending = false;
+    if (Blob == Stored && !Legacy)
+    {
+        ++Unchanged;
+        return;
+    }
+    auto key = String('@') + Current->GetPath();
+    size_t ret = Blob.empty() ? Prefs.remove(key.c_str()) : Prefs.putBytes(key.c_str(), Blob.data(), Blob.size());
+    if (ret == 0 && !Blob.empty())
+    {
+        floge("preferences write error object path: %s  name: %s", key.c_str(), Current->Name);
+        return;
+    }
+    ++Writes;
+    if (Legacy)
+    {
+        // the blob replaces them
+        for (auto p : Current->Properties)
+        {
+            auto path = p->GetPath();
+            if (Prefs.isKey(path.c_str()))
+                Prefs.remove(path.c_str());
+        }
+        Legacy = false;
+    }
+    Stored = Blob;
+}
+
+void OMPrefs::Append(std::vector<uint8_t>& blob, char id, const String& v)
+{
+    blob.push_back(id);
+    blob.push_back(v.length() & 0xFF);
+    blob.push_back(v.length() >> 8);
+    blob.insert(blob.end(), v.c_str(), v.c_str() + v.length());
+}
+
+int OMPrefs::Find(char id)
+{
+    size_t inx = 0;
+    while (inx + 3 <= Blob.size())
+    {
+        if ((char)Blob[inx] == id)
+            return inx;
+        inx += 3 + ValueLength(inx);
+    }
+    return -1;
+}
+
+void OMPrefs::Erase(char id)
+{
+    auto inx = Find(id);
+    if (inx >= 0)
+    {
+        Blob.erase(Blob.begin() + inx, Blob.begin() + inx + 3 + ValueLength(inx));
+        Pending = true;
+    }
+}
+
+void OMPrefs::Put(OMProperty* prop)
+{
+    String v = prop->ToString();
+    if (v.length() > 0xFFFF)
+    {
+        floge("preference too long: %s.%s", prop->Parent->Name, prop->Name);
+        return;
+    }
+    flogi("save pref: %s.%s [%s]", prop->Parent->Name, prop->Name, v.c_str());
+    Pending = true;
+    auto inx = Find(prop->Id);
+    if (inx < 0)
+    {
+        Append(Blob, prop->Id, v);
+        return;
+    }
+    // replaced where it stands, so an unchanged value leaves the blob identical to what is stored
+    // and Write counts the save as Unchanged rather than rewriting flash
+    auto value = (const uint8_t*)v.c_str();
+    uint16_t len = ValueLength(inx);
+    if (len == v.length() && memcmp(&Blob[inx + 3], value, len) == 0)
+        return;
+    Blob[inx + 1] = v.length() & 0xFF;
+    Blob[inx + 2] = v.length() >> 8;
+    Blob.erase(Blob.begin() + inx + 3, Blob.begin() + inx + 3 + len);
+    Blob.insert(Blob.begin() + inx + 3, value, value + v.length());
+}
+
+void OMPrefs::Apply(OMProperty* prop)
+{
+    auto inx = Find(prop->Id);
+    if (inx < 0)
+        return;
+    String v((const char*)&Blob[inx + 3], ValueLength(inx));
+    if (v.length() > 0)
+    {
+        flogv("load pref: %s.%s [%s]", prop->Parent->Name, prop->Name, v.c_str());
+        prop->FromString(v);
+    }
+}
+
+void OMPrefs::Save(OMObject* obj, bool recurse)
+{
+    Read(obj);
+    for (auto p : obj->Properties)
+    {
+        if (p->IsPersisted())
+            Put(p);
+    }
+    if (recurse)
+    {
+        for (auto o : obj->Objects)
+            Save(o, true);
+    }
+}
+
+void OMPrefs::Load(OMObject* obj, bool recurse)
+{
+    Read(obj);
+    for (auto p : obj->Properties)
+    {
+        if (p->IsPersisted())
+            Apply(p);
+    }
+    // migrate to a blob once, rather than gathering the old keys every boot
+    if (Legacy)
+        Pending = true;
+    if (recurse)
+    {
+        for (auto o : obj->Objects)
+            Load(o, true);
+    }
+}
+
+void OMPrefs::Dump(OMObject* obj, bool recurse)
+{
+    for (auto p : obj->Properties)
+        Dump(p);
+    if (recurse)
+    {
+        for (auto o : obj->Objects)
+            Dump(o, true);
+    }
+}
+
+void OMPrefs::Remove(OMObject* obj, bool recurse)
+{
+    Read(obj);
+    if (!Blob.empty())
+        flogi("remove prefs: %s", obj->Name);
+    Blob.clear();
+    Pending = true;
+    if (recurse)
+    {
+        for (auto o : obj->Objects)
+            Remove(o, true);
+    }
+}
+
+void OMPrefs::Save(OMProperty* prop)
+{
+    if (!prop->IsPersisted())
+        return;
+    Read((OMObject*)prop->Parent);
+    Put(prop);
+}
+
+void OMPrefs::Load(OMProperty* prop)
+{
+    if (!prop->IsPersisted())
+        return;
+    Read((OMObject*)prop->Parent);
+    Apply(prop);
+}
+
+void OMPrefs::Dump(OMProperty* prop)
+{
+    Read((OMObject*)prop->Parent);
+    auto inx = Find(prop->Id);
+    if (inx >= 0)
+    {
+        String v((const char*)&Blob[inx + 3], ValueLength(inx));
+        flogi("dump pref: %s.%s [%s]", prop->Parent->Name, prop->Name, v.c_str());
+    }
+}
+
+void OMPrefs::Remove(OMProperty* prop)
+{
+    Read((OMObject*)prop->Parent);
+    if (Find(prop->Id) < 0)
+        return;
+    Erase(prop->Id);
+    flogi("remove pref: %s.%s", prop->Parent->Name, prop->Name);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <vector>
+#include "OMObject.h"
+
+// batched preferences
+// the namespace is opened once for the life of an OMPrefs, so a traversal costs one open,
+// and each object's persisted properties are stored together as one blob keyed by '@' + its path:
+//      { property id, value length (2 bytes, low first), value chars } ...
+// a blob is written once per object per OMPrefs, when moving on to another object or at
+// destruction, and then only when its contents changed; saving several properties of an
+// object one at a time costs a single write
+// objects saved before blobs (a key per property path) are migrated when first loaded
+class OMPrefs
+{
+public:
+    OMPrefs();
+    ~OMPrefs();
+    // an object's properties, and with recurse those of its whole subtree
+    void    Save(OMObject* obj, bool recurse = false);
+    void    Load(OMObject* obj, bool recurse = false);
+    void    Dump(OMObject* obj, bool recurse = false);
+    void    Remove(OMObject* obj, bool recurse = false);
+    // a single property, leaving the rest of its object's blob as stored
+    void    Save(OMProperty* prop);
+    void    Load(OMProperty* prop);
+    void    Dump(OMProperty* prop);
+    void    Remove(OMProperty* prop);
+
+    static uint32_t Writes;         // blobs written to flash
+    static uint32_t Unchanged;      // blob writes skipped as identical to what is stored
+private:
+    Preferences     Prefs;
+    bool            Open = false;
+    OMObject*       Current = nullptr;      // object whose blob is read into Stored and Blob
+    bool            Legacy = false;         // Stored came from per property keys
+    bool            Pending = false;        // Blob changed since Read; write before moving on
+    std::vector<uint8_t> Stored;
+    std::vector<uint8_t> Blob;
+    void    Read(OMObject* obj);
+    void    Write();
+    int     Find(char id);
+    uint16_t ValueLength(int inx) { return Blob[inx + 1] | (Blob[inx + 2] << 8); }
+    static void Append(std::vector<uint8_t>& blob, char id, const String& v);
+    void    Put(OMProperty* prop);
+    void    Erase(char id);
+    void    Apply(OMProperty* prop);
+};
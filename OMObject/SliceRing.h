@@ -0,0 +1,112 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+// fixed-capacity ring of variable length byte slices
+// single producer / single consumer, lock-free:
+// the producer only writes Head, the consumer only writes Tail
+// so e.g. the ESP-NOW receive callback (Wi-Fi task) can feed Agent::Run (loop task)
+// without allocating or masking interrupts
+//
+// each slice is stored as a 2 byte length followed by its data, wrapping at the end of the buffer
+// N must be a power of 2
+template <size_t N> class OMSliceRing
+{
+public:
+    // producer: append a slice, optionally preceded by a prefix stored in the same slice
+    // returns false (and counts a drop) if there is not enough room
+    bool Push(const uint8_t* data, uint16_t len) { return Push(nullptr, 0, data, len); }
+    bool Push(const uint8_t* prefix, uint16_t prefixLen, const uint8_t* data, uint16_t len)
+    {
+        auto head = Head.load(std::memory_order_relaxed);
+        uint16_t total = prefixLen + len;
+        uint32_t used = head - Tail.load(std::memory_order_acquire);
+        if (used + 2 + total > N)
+        {
+            ++Dropped;
+            return false;
+        }
+        uint8_t hdr[2] = { (uint8_t)total, (uint8_t)(total >> 8) };
+        Write(head, hdr, 2);
+        Write(head + 2, prefix, prefixLen);
+        Write(head + 2 + prefixLen, data, len);
+        Head.store(head + 2 + total, std::memory_order_release);
+        ++Pushed;
+        if (used + 2 + total > HighWater)
+            HighWater = used + 2 + total;
+        return true;
+    }
+
+    // consumer: remove the oldest slice into buf
+    // returns its length or 0 if the ring is empty
+    // a slice longer than size is discarded and counted as truncated
+    uint16_t Pop(uint8_t* buf, uint16_t size)
+    {
+        auto tail = Tail.load(std::memory_order_relaxed);
+        if (Head.load(std::memory_order_acquire) == tail)
+            return 0;
+        uint8_t hdr[2];
+        Read(tail, hdr, 2);
+        uint16_t stored = hdr[0] | (hdr[1] << 8);
+        uint16_t len = stored;
+        if (len > size)
+        {
+            ++Truncated;
+            len = 0;
+        }
+        else
+        {
+            Read(tail + 2, buf, len);
+        }
+        Tail.store(tail + 2 + stored, std::memory_order_release);
+        ++Popped;
+        return len;
+    }
+
+    // consumer: length of the oldest slice or 0 if the ring is empty
+    uint16_t Peek()
+    {
+        auto tail = Tail.load(std::memory_order_relaxed);
+        if (Head.load(std::memory_order_acquire) == tail)
+            return 0;
+        uint8_t hdr[2];
+        Read(tail, hdr, 2);
+        return hdr[0] | (hdr[1] << 8);
+    }
+
+    bool        Empty() { return Head.load(std::memory_order_acquire) == Tail.load(std::memory_order_acquire); }
+    uint32_t    Count() { return Pushed - Popped; }
+    uint32_t    Free() { return N - Used(); }
+    uint32_t    Used() { return Head.load(std::memory_order_acquire) - Tail.load(std::memory_order_acquire); }
+
+    // producer side counters
+    uint32_t    Pushed = 0;         // slices accepted
+    uint32_t    Dropped = 0;        // slices lost to a full ring
+    uint32_t    HighWater = 0;      // most bytes ever in use
+    // consumer side counters
+    uint32_t    Popped = 0;         // slices removed
+    uint32_t    Truncated = 0;      // slices discarded for not fitting the Pop buffer
+private:
+    uint8_t     Buffer[N];
+    std::atomic<uint32_t> Head { 0 };   // free running write position
+    std::atomic<uint32_t> Tail { 0 };   // free running read position
+
+    void Write(uint32_t pos, const uint8_t* data, uint16_t len)
+    {
+        if (len == 0)
+            return;
+        auto inx = pos & (N - 1);
+        auto first = len < N - inx ? len : N - inx;
+        memcpy(Buffer + inx, data, first);
+        memcpy(Buffer, data + first, len - first);
+    }
+
+    void Read(uint32_t pos, uint8_t* data, uint16_t len)
+    {
+        auto inx = pos & (N - 1);
+        auto first = len < N - inx ? len : N - inx;
+        memcpy(data, Buffer + inx, first);
+        memcpy(data + first, Buffer, len - first);
+    }
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+// fixed-capacity queue of T
+// single producer / single consumer, lock-free:
+// the producer only writes Head, the consumer only writes Tail
+// N must be a power of 2
+template <typename T, size_t N> class OMSpscQueue
+{
+public:
+    // producer: returns false (and counts a drop) if the queue is full
+    bool Push(const T& item)
+    {
+        auto head = Head.load(std::memory_order_relaxed);
+        if (head - Tail.load(std::memory_order_acquire) >= N)
+        {
+            ++Dropped;
+            return false;
+        }
+        Items[head & (N - 1)] = item;
+        Head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer: the oldest item or nullptr if empty; valid until Pop
+    T* Front()
+    {
+        auto tail = Tail.load(std::memory_order_relaxed);
+        if (Head.load(std::memory_order_acquire) == tail)
+            return nullptr;
+        return &Items[tail & (N - 1)];
+    }
+
+    // consumer: remove the oldest item
+    void Pop()
+    {
+        auto tail = Tail.load(std::memory_order_relaxed);
+        if (Head.load(std::memory_order_acquire) != tail)
+            Tail.store(tail + 1, std::memory_order_release);
+    }
+
+    bool        Empty() { return Head.load(std::memory_order_acquire) == Tail.load(std::memory_order_acquire); }
+    uint32_t    Size() { return Head.load(std::memory_order_acquire) - Tail.load(std::memory_order_acquire); }
+
+    uint32_t    Dropped = 0;        // items lost to a full queue (producer side)
+private:
+    T           Items[N];
+    std::atomic<uint32_t> Head { 0 };   // free running write position
+    std::atomic<uint32_t> Tail { 0 };   // free running read position
+};
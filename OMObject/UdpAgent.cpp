@@ -0,0 +1,104 @@
+#include "UdpAgent.h"
+#include "FLogger.h"
+
+void UdpAgent::Setup(IPAddress peerAddress, uint16_t peerPort, uint16_t localPort)
+{
+    PeerAddress = peerAddress;
+    PeerPort = peerPort;
+    if (!Udp.begin(localPort))
+        flogf("UDP listen on port %u FAILED", localPort);
+    flogi("UDP agent: port %u to %s:%u", localPort, peerAddress.toString().c_str(), peerPort);
+    EnableSequencing();
+
+    if (pRoot->IsDevice)
+    {
+        Send((uint8_t*)".", 1);     // send heartbeat to let controller know we're alive
+    }
+    else
+    {
+        // longer timeout on the controller
+        // so we're not racing with the device to respond
+        Metro.PeriodMS += 1000;
+    }
+}
+
+void UdpAgent::Run()
+{
+    // drain the socket; each datagram is one frame
+    uint8_t data[256];
+    while (Udp.parsePacket() > 0)
+    {
+        int len = Udp.read(data, sizeof(data));
+        if (!(Udp.remoteIP() == PeerAddress) || Udp.remotePort() != PeerPort)
+        {
+            ++Strays;
+            continue;
+        }
+        ++FramesIn;
+        Receive(data, len);
+    }
+
+    if (Metro)
+    {
+        if (pRoot->IsDevice)
+            Send((uint8_t*)".", 1);
+        else if (Connected)
+        {
+            flogv("device offline");
+            SetConnection(false);
+        }
+    }
+
+    Agent::Run();
+}
+
+bool UdpAgent::Send(const uint8_t *pData, int len)
+{
+    if (!Udp.beginPacket(PeerAddress, PeerPort) || Udp.write(pData, len) != (size_t)len || !Udp.endPacket())
+    {
+        floge("UDP send failed");
+        return false;
+    }
+    if (pRoot->IsDevice)
+        Metro.Reset();  // anything sent serves as a heartbeat
+    return true;
+}
+
+void UdpAgent::Receive(const uint8_t *pData, int len)
+{
+    SetConnection(true);
+    if (len <= 0)
+        return;
+    switch (pData[0])
+    {
+    case '.':   // heartbeat from device (actions taken above are all we need)
+        break;
+    case OMB_FRAME:
+        ReceiveRecords(pData + 1, len - 1);
+        break;
+    case OMS_FRAME:
+        ReceiveSequenced(pData, len);
+        break;
+    case OMA_FRAME:
+        ReceiveAck(pData, len);
+        break;
+    default:
+        ReceiveCommands(pData, len);
+        break;
+    }
+}
+
+void UdpAgent::SetConnection(bool connect)
+{
+    if (connect && !pRoot->IsDevice)
+        Metro.Reset();
+    if (connect == Connected)
+        return;
+    Connected = connect;
+    pRoot->ConnectionChanged(connect);
+}
+
+void UdpAgent::StartFileTransfer(String filePath)
+{
+    floge("File transfer not supported over UDP: %s", filePath.c_str());
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFiUdp.h>
+#include "FS.h"
+#include "Agent.h"
+#include "Metronome.h"
+
+// the command channel over UDP, for peers on a Wi-Fi network rather than ESP-NOW
+// frames are polled from Run, sequenced and ACKed like ESP-NOW's
+// the device sends '.' heartbeats; the controller declares it offline when they stop
+class UdpAgent : public Agent
+{
+public:
+    UdpAgent(FS* pfs, Root* proot) : Agent(pfs, proot), Metro(5000) { };
+    // listen on localPort and send to peerPort at peerAddress; Wi-Fi must already be connected
+    void    Setup(IPAddress peerAddress, uint16_t peerPort, uint16_t localPort);
+    void    Run() override;
+    bool    Send(const uint8_t *pData, int len) override;
+    void    StartFileTransfer(String filePath) override;
+
+    uint32_t    FramesIn = 0;
+    uint32_t    Strays = 0;         // datagrams from somewhere other than the peer
+private:
+    WiFiUDP     Udp;
+    IPAddress   PeerAddress;
+    uint16_t    PeerPort = 0;
+	Metronome	Metro;
+    bool        Connected = false;
+    void    SetConnection(bool connect);
+    void    Receive(const uint8_t *pData, int len);
+};